@@ -0,0 +1,386 @@
+#include "BatchPipeline.hpp"
+#include "BoundedQueue.hpp"
+#include "Tracer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+const char* const TRACE_CATEGORY = "BatchPipeline";
+
+// A decoded source on its way to the scale stage, with the size of each of its outputs
+struct PipelineItem {
+    size_t job = 0;
+    AVFrame* source = nullptr;
+    std::vector<int> dstWidths;
+    std::vector<int> dstHeights;
+
+    ~PipelineItem() {
+        av_frame_free(&source);
+    }
+};
+
+// One output on its way to the encode stage; scaled belongs to the frame pool
+struct ScaledItem {
+    size_t job;
+    size_t output;
+    AVFrame* scaled;
+};
+
+// Fixed set of output frames recycled between the scale and encode stages. Buffers are
+// kept while consecutive images share an output size; an empty pool stalls the scalers,
+// which bounds how much decoded and scaled data can pile up.
+class FramePool {
+public:
+    explicit FramePool(size_t count) : frames(count) {
+        for (size_t i = 0; i < count; i++) {
+            AVFrame* frame = av_frame_alloc();
+            if (!frame) {
+                throw std::runtime_error("Could not allocate pooled frame");
+            }
+            frames.tryPush(frame);
+        }
+    }
+
+    ~FramePool() {
+        AVFrame* frame;
+        while (frames.tryPop(frame)) {
+            av_frame_free(&frame);
+        }
+    }
+
+    AVFrame* acquire(AVPixelFormat format, int width, int height) {
+        AVFrame* frame;
+        Backoff backoff;
+        while (!frames.tryPop(frame)) {
+            backoff.pause();
+        }
+        if (!frame->buf[0] || frame->format != format || frame->width != width || frame->height != height) {
+            av_frame_unref(frame);
+            frame->format = format;
+            frame->width = width;
+            frame->height = height;
+            if (av_frame_get_buffer(frame, 0) < 0) {
+                release(frame);
+                throw std::runtime_error("Could not allocate pooled frame buffer");
+            }
+        }
+        return frame;
+    }
+
+    // Never fails: only frames taken from this pool come back to it
+    void release(AVFrame* frame) {
+        frames.tryPush(frame);
+    }
+
+private:
+    BoundedQueue<AVFrame*> frames;
+};
+
+// Counts a stage worker out however it exits, so the next stage never waits on it forever
+class StageExit {
+public:
+    explicit StageExit(std::atomic<unsigned>& workersLeft) : workersLeft(workersLeft) {}
+    ~StageExit() {
+        workersLeft.fetch_sub(1, std::memory_order_release);
+    }
+
+    StageExit(const StageExit&) = delete;
+    StageExit& operator=(const StageExit&) = delete;
+
+private:
+    std::atomic<unsigned>& workersLeft;
+};
+
+template <typename T>
+void pushWait(BoundedQueue<T>& queue, const T& value) {
+    Backoff backoff;
+    while (!queue.tryPush(value)) {
+        backoff.pause();
+    }
+}
+
+// Pop the next item; false once the upstream stage has finished and the queue is drained
+template <typename T>
+bool popWait(BoundedQueue<T>& queue, const std::atomic<unsigned>& producersLeft, T& value) {
+    Backoff backoff;
+    for (;;) {
+        // Checked before the pop: if every producer had finished, nothing new can arrive
+        bool upstreamDone = producersLeft.load(std::memory_order_acquire) == 0;
+        if (queue.tryPop(value)) {
+            return true;
+        }
+        if (upstreamDone) {
+            return false;
+        }
+        backoff.pause();
+    }
+}
+
+// First frame of any libav-readable image, decoded on the calling thread
+AVFrame* decodeFirstFrame(const std::string& inputPath) {
+    AVFormatContext* formatContext = nullptr;
+    AVCodecContext* decoder = nullptr;
+    AVPacket* packet = nullptr;
+    AVFrame* frame = nullptr;
+    AVFrame* result = nullptr;
+
+    try {
+        if (avformat_open_input(&formatContext, inputPath.c_str(), nullptr, nullptr) != 0) {
+            throw std::runtime_error("Error opening input file: " + inputPath);
+        }
+        if (avformat_find_stream_info(formatContext, nullptr) < 0) {
+            throw std::runtime_error("Error finding stream info for input file: " + inputPath);
+        }
+        int videoStreamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+        if (videoStreamIndex < 0) {
+            throw std::runtime_error("Could not find video stream in input file: " + inputPath);
+        }
+
+        AVCodecParameters* codecParams = formatContext->streams[videoStreamIndex]->codecpar;
+        const AVCodec* codec = avcodec_find_decoder(codecParams->codec_id);
+        if (!codec) {
+            throw std::runtime_error("Error finding decoder for the video stream");
+        }
+        decoder = avcodec_alloc_context3(codec);
+        if (!decoder || avcodec_parameters_to_context(decoder, codecParams) < 0) {
+            throw std::runtime_error("Error copying codec parameters to codec context");
+        }
+        // Parallelism comes from running several decode workers
+        decoder->thread_count = 1;
+        if (avcodec_open2(decoder, codec, nullptr) < 0) {
+            throw std::runtime_error("Error opening codec");
+        }
+
+        packet = av_packet_alloc();
+        frame = av_frame_alloc();
+        if (!packet || !frame) {
+            throw std::runtime_error("Could not allocate frame or packet");
+        }
+        while (!result && av_read_frame(formatContext, packet) >= 0) {
+            if (packet->stream_index == videoStreamIndex &&
+                avcodec_send_packet(decoder, packet) >= 0 &&
+                avcodec_receive_frame(decoder, frame) >= 0) {
+                result = frame;
+                frame = nullptr;
+            }
+            av_packet_unref(packet);
+        }
+        if (!result) {
+            throw std::runtime_error("Could not decode a frame from " + inputPath);
+        }
+    } catch (...) {
+        av_frame_free(&frame);
+        av_packet_free(&packet);
+        avcodec_free_context(&decoder);
+        avformat_close_input(&formatContext);
+        throw;
+    }
+
+    av_packet_free(&packet);
+    avcodec_free_context(&decoder);
+    avformat_close_input(&formatContext);
+    return result;
+}
+
+// Decode an input and work out its output sizes. JPEG sources go through the codec backend
+// so they get one reduced-size (scaled IDCT) decode that still covers the largest output.
+void decodeItem(const BatchJob& job, JpegCodec& jpegCodec, PipelineItem& item) {
+    for (const BatchOutput& output : job.outputs) {
+        int width = presetWidth(output.size);
+        if (width < 0) {
+            throw std::runtime_error("Invalid preset size");
+        }
+        item.dstWidths.push_back(width);
+    }
+
+    std::vector<uint8_t> bytes;
+    {
+        TraceScope trace(TRACE_CATEGORY, "demux");
+        std::ifstream input(job.inputPath, std::ios::binary);
+        if (input.get() == 0xFF && input.peek() == 0xD8) {
+            input.seekg(0);
+            bytes.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        }
+    }
+
+    TraceScope trace(TRACE_CATEGORY, "decode");
+    int sourceWidth, sourceHeight;
+    bool jpeg = !bytes.empty() && readJpegDimensions(bytes.data(), bytes.size(), sourceWidth, sourceHeight);
+    if (!jpeg) {
+        item.source = decodeFirstFrame(job.inputPath);
+        sourceWidth = item.source->width;
+        sourceHeight = item.source->height;
+    }
+    for (int width : item.dstWidths) {
+        item.dstHeights.push_back(static_cast<int>(round(static_cast<double>(sourceHeight) * width / sourceWidth)));
+    }
+    if (jpeg) {
+        size_t largest = std::max_element(item.dstWidths.begin(), item.dstWidths.end()) - item.dstWidths.begin();
+        item.source = jpegCodec.decode(bytes.data(), bytes.size(), item.dstWidths[largest], item.dstHeights[largest]);
+    }
+}
+
+} // namespace
+
+BatchPipeline::BatchPipeline(const StageThreads& threads) : threads(threads) {
+    if (threads.decode == 0 || threads.scale == 0 || threads.encode == 0) {
+        throw std::runtime_error("Every pipeline stage needs at least one thread");
+    }
+}
+
+void BatchPipeline::setJpegBackend(JpegBackend backend) {
+    if (!jpegBackendAvailable(backend)) {
+        throw std::runtime_error("JPEG backend not available in this build");
+    }
+    jpegBackend = backend;
+}
+
+void BatchPipeline::setJpegOptions(const JpegOptions& options) {
+    jpegOptions = options;
+}
+
+std::vector<std::string> BatchPipeline::run(const std::vector<BatchJob>& jobs) {
+    std::vector<std::string> errors(jobs.size());
+    std::mutex errorMutex;
+    // Outputs of one job fail independently on different workers; the first error is kept
+    auto fail = [&](size_t job, const char* message) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (errors[job].empty()) {
+            errors[job] = message;
+        }
+    };
+
+    // Queues hold a couple of items per consumer so a stage rarely waits on its neighbour
+    BoundedQueue<PipelineItem*> decoded(2 * threads.scale + 2);
+    BoundedQueue<ScaledItem> scaled(2 * threads.encode + 2);
+    FramePool framePool(threads.scale + 2 * threads.encode);
+    std::atomic<size_t> nextJob(0);
+    std::atomic<unsigned> decodersLeft(threads.decode);
+    std::atomic<unsigned> scalersLeft(threads.scale);
+
+    // Codecs are created here so a failure throws from run() before any worker starts;
+    // inside the workers every exception is caught per item, so no worker leaves early
+    std::vector<std::unique_ptr<JpegCodec>> decodeCodecs;
+    std::vector<std::unique_ptr<JpegCodec>> encodeCodecs;
+    for (unsigned i = 0; i < threads.decode; i++) {
+        decodeCodecs.push_back(createJpegCodec(jpegBackend));
+    }
+    for (unsigned i = 0; i < threads.encode; i++) {
+        encodeCodecs.push_back(createJpegCodec(jpegBackend));
+    }
+
+    auto decodeWorker = [&](JpegCodec* jpegCodec) {
+        StageExit exit(decodersLeft);
+        for (size_t index; (index = nextJob++) < jobs.size();) {
+            if (jobs[index].outputs.empty()) {
+                continue;
+            }
+            try {
+                std::unique_ptr<PipelineItem> item(new PipelineItem);
+                item->job = index;
+                decodeItem(jobs[index], *jpegCodec, *item);
+                pushWait(decoded, item.release());
+            } catch (const std::exception& e) {
+                fail(index, e.what());
+            } catch (...) {
+                fail(index, "Unknown error while decoding");
+            }
+        }
+    };
+
+    auto scaleWorker = [&]() {
+        StageExit exit(scalersLeft);
+        SwsContext* swsContext = nullptr;
+        PipelineItem* item;
+        while (popWait(decoded, decodersLeft, item)) {
+            // The decoded frame is the largest buffer in flight; it goes as soon as every output is scaled
+            std::unique_ptr<PipelineItem> owner(item);
+            const AVFrame* src = item->source;
+            for (size_t output = 0; output < item->dstWidths.size(); output++) {
+                ScaledItem result = {item->job, output, nullptr};
+                try {
+                    TraceScope trace(TRACE_CATEGORY, "scale");
+                    int dstWidth = item->dstWidths[output];
+                    int dstHeight = item->dstHeights[output];
+                    result.scaled = framePool.acquire(AV_PIX_FMT_RGB24, dstWidth, dstHeight);
+                    swsContext = sws_getCachedContext(swsContext,
+                        src->width, src->height, static_cast<AVPixelFormat>(src->format),
+                        dstWidth, dstHeight, AV_PIX_FMT_RGB24,
+                        SWS_BILINEAR, nullptr, nullptr, nullptr
+                    );
+                    if (!swsContext) {
+                        throw std::runtime_error("Could not initialize scaling context");
+                    }
+                    sws_scale(swsContext, src->data, src->linesize, 0, src->height,
+                              result.scaled->data, result.scaled->linesize);
+                    pushWait(scaled, result);
+                } catch (const std::exception& e) {
+                    fail(item->job, e.what());
+                    if (result.scaled) {
+                        framePool.release(result.scaled);
+                    }
+                } catch (...) {
+                    fail(item->job, "Unknown error while scaling");
+                    if (result.scaled) {
+                        framePool.release(result.scaled);
+                    }
+                }
+            }
+        }
+        sws_freeContext(swsContext);
+    };
+
+    auto encodeWorker = [&](JpegCodec* jpegCodec) {
+        std::vector<uint8_t> jpeg;
+        ScaledItem item;
+        while (popWait(scaled, scalersLeft, item)) {
+            try {
+                {
+                    TraceScope trace(TRACE_CATEGORY, "encode");
+                    jpegCodec->encode(item.scaled->data[0], item.scaled->linesize[0],
+                                      item.scaled->width, item.scaled->height, jpegOptions, jpeg);
+                }
+                TraceScope trace(TRACE_CATEGORY, "write");
+                const std::string& outputPath = jobs[item.job].outputs[item.output].outputPath;
+                FILE* outFile = fopen(outputPath.c_str(), "wb");
+                if (!outFile) {
+                    throw std::runtime_error("Could not open output file: " + outputPath);
+                }
+                // A full disk shows up in either call; both must count as a failed job
+                bool written = fwrite(jpeg.data(), 1, jpeg.size(), outFile) == jpeg.size();
+                if (fclose(outFile) != 0 || !written) {
+                    throw std::runtime_error("Could not write output file: " + outputPath);
+                }
+            } catch (const std::exception& e) {
+                fail(item.job, e.what());
+            } catch (...) {
+                fail(item.job, "Unknown error while encoding");
+            }
+            framePool.release(item.scaled);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads.decode; i++) {
+        workers.emplace_back(decodeWorker, decodeCodecs[i].get());
+    }
+    for (unsigned i = 0; i < threads.scale; i++) {
+        workers.emplace_back(scaleWorker);
+    }
+    for (unsigned i = 0; i < threads.encode; i++) {
+        workers.emplace_back(encodeWorker, encodeCodecs[i].get());
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    return errors;
+}
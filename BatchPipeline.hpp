@@ -0,0 +1,51 @@
+#ifndef BATCH_PIPELINE_HPP
+#define BATCH_PIPELINE_HPP
+
+#include <string>
+#include <vector>
+
+#include "FFmpegResizer.hpp"
+#include "JpegCodec.hpp"
+
+struct BatchOutput {
+    std::string outputPath;
+    ImageSize size;
+};
+
+// One source and every size to produce from it; the source is decoded once
+struct BatchJob {
+    std::string inputPath;
+    std::vector<BatchOutput> outputs;
+};
+
+// Workers per stage. Decode and encode dominate for large and small outputs respectively,
+// so they are tuned separately from the (usually cheap) scale stage.
+struct StageThreads {
+    unsigned decode = 2;
+    unsigned scale = 1;
+    unsigned encode = 2;
+};
+
+// Batch resizer with decode, scale and encode running as separate stages, each on its own
+// workers, connected by bounded lock-free queues. Each source is decoded once, at the size its
+// largest output needs, and the scale stage fans it out to every output. Scaled frames come
+// from a fixed pool that also bounds how many images are in flight. Unlike FFmpegResizer,
+// one image's encode overlaps the next image's decode.
+class BatchPipeline {
+public:
+    explicit BatchPipeline(const StageThreads& threads = StageThreads());
+
+    void setJpegBackend(JpegBackend backend);
+    void setJpegOptions(const JpegOptions& options);
+
+    // Resize every job to its preset widths; returns one error message per job ("" on success,
+    // otherwise the first output that failed)
+    std::vector<std::string> run(const std::vector<BatchJob>& jobs);
+
+private:
+    StageThreads threads;
+    JpegBackend jpegBackend = JpegBackend::LIBAV;
+    JpegOptions jpegOptions;
+};
+
+#endif // BATCH_PIPELINE_HPP
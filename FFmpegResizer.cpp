@@ -1,4 +1,308 @@
 #include "FFmpegResizer.hpp"
+#include "FastScale.hpp"
+#include "ThreadPool.hpp"
+#include "Tracer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+bool presetFromName(const std::string& name, ImageSize& size) {
+    for (const PresetSpec& preset : PRESETS) {
+        if (name == preset.name) {
+            size = preset.size;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the box-downsampling factor (2, 4 or 8) if the frame is 8-bit planar data
+// and every plane divides exactly into the destination size, 0 otherwise
+static int boxDownsampleFactor(const AVFrame* src, int dstWidth, int dstHeight) {
+    int factor = fastscale::exactDownscaleFactor(src->width, src->height, dstWidth, dstHeight);
+    if (!factor) {
+        return 0;
+    }
+
+    AVPixelFormat format = static_cast<AVPixelFormat>(src->format);
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+    if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_BE | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM |
+                                 AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_FLOAT))) {
+        return 0;
+    }
+    for (int i = 0; i < desc->nb_components; i++) {
+        if (desc->comp[i].depth != 8 || desc->comp[i].step != 1) {
+            return 0;
+        }
+    }
+
+    for (int plane = 0; plane < av_pix_fmt_count_planes(format); plane++) {
+        bool chroma = plane == 1 || plane == 2;
+        int shiftW = chroma ? desc->log2_chroma_w : 0;
+        int shiftH = chroma ? desc->log2_chroma_h : 0;
+        if (AV_CEIL_RSHIFT(src->width, shiftW) != AV_CEIL_RSHIFT(dstWidth, shiftW) * factor ||
+            AV_CEIL_RSHIFT(src->height, shiftH) != AV_CEIL_RSHIFT(dstHeight, shiftH) * factor) {
+            return 0;
+        }
+    }
+    return factor;
+}
+
+namespace {
+
+const char* const TRACE_CATEGORY = "FFmpegResizer";
+
+int readPacket(AVFormatContext* formatContext, AVPacket* packet) {
+    TraceScope trace(TRACE_CATEGORY, "demux");
+    return av_read_frame(formatContext, packet);
+}
+
+// Read a JPEG file's marker segments up to the first scan, skipping the entropy-coded data.
+// This is enough for the frame size and the EXIF thumbnail.
+bool readJpegHeaders(const std::string& inputPath, std::vector<uint8_t>& headers) {
+    TraceScope trace(TRACE_CATEGORY, "demux");
+    std::ifstream input(inputPath, std::ios::binary);
+    uint8_t marker[4];
+    if (!input.read(reinterpret_cast<char*>(marker), 2) || marker[0] != 0xFF || marker[1] != 0xD8) {
+        return false;
+    }
+    headers.assign(marker, marker + 2);
+
+    while (input.read(reinterpret_cast<char*>(marker), 4) && marker[0] == 0xFF) {
+        headers.insert(headers.end(), marker, marker + 4);
+        if (marker[1] == 0xDA) {
+            return true;
+        }
+        size_t length = (marker[2] << 8) | marker[3];
+        if (length < 2) {
+            return false;
+        }
+        size_t start = headers.size();
+        headers.resize(start + length - 2);
+        if (!input.read(reinterpret_cast<char*>(headers.data() + start), length - 2)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+// Output side of a multi-frame resize: muxer, encoder and stream, freed on scope exit
+struct AnimatedOutput {
+    AVFormatContext* formatContext = nullptr;
+    AVCodecContext* encoder = nullptr;
+    AVStream* stream = nullptr;
+    AVPacket* packet = nullptr;
+
+    ~AnimatedOutput() {
+        av_packet_free(&packet);
+        avcodec_free_context(&encoder);
+        if (formatContext) {
+            if (formatContext->pb && !(formatContext->oformat->flags & AVFMT_NOFILE)) {
+                avio_closep(&formatContext->pb);
+            }
+            avformat_free_context(formatContext);
+        }
+    }
+
+    // Send a frame (nullptr flushes) and mux every packet the encoder hands back
+    void encode(const AVFrame* scaled) {
+        TraceScope trace(TRACE_CATEGORY, "encode");
+        if (avcodec_send_frame(encoder, scaled) < 0) {
+            throw std::runtime_error("Error sending frame to encoder");
+        }
+        while (avcodec_receive_packet(encoder, packet) >= 0) {
+            av_packet_rescale_ts(packet, encoder->time_base, stream->time_base);
+            packet->stream_index = stream->index;
+            TraceScope writeTrace(TRACE_CATEGORY, "write");
+            if (av_interleaved_write_frame(formatContext, packet) < 0) {
+                throw std::runtime_error("Error writing output frame");
+            }
+        }
+    }
+};
+
+// Scaled frames come back from the workers in any order; the reorder buffer
+// hands them to the encoder strictly by sequence number
+class FrameReorderBuffer {
+public:
+    ~FrameReorderBuffer() {
+        for (auto& entry : frames) {
+            av_frame_free(&entry.second);
+        }
+    }
+
+    void put(int64_t sequence, AVFrame* scaled) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            frames[sequence] = scaled;
+        }
+        ready.notify_all();
+    }
+
+    void fail(std::exception_ptr exception) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = exception;
+            }
+        }
+        ready.notify_all();
+    }
+
+    // Returns the frame for sequence, or nullptr if it is not ready and wait is false
+    AVFrame* take(int64_t sequence, bool wait) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (wait) {
+            TraceScope trace(TRACE_CATEGORY, "reorder_wait");
+            ready.wait(lock, [&] { return error || frames.count(sequence); });
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        auto it = frames.find(sequence);
+        if (it == frames.end()) {
+            return nullptr;
+        }
+        AVFrame* scaled = it->second;
+        frames.erase(it);
+        return scaled;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::map<int64_t, AVFrame*> frames;
+    std::exception_ptr error;
+};
+
+// Each pool worker keeps its own scaler, since an SwsContext must not be shared across threads
+struct WorkerScaler {
+    SwsContext* context = nullptr;
+    ~WorkerScaler() {
+        sws_freeContext(context);
+    }
+};
+thread_local WorkerScaler workerScaler;
+
+// Scale and convert a decoded frame straight into the encoder's pixel format
+AVFrame* scaleForEncoder(const AVFrame* src, int dstWidth, int dstHeight, AVPixelFormat dstFormat) {
+    TraceScope trace(TRACE_CATEGORY, "scale");
+    AVFrame* scaled = av_frame_alloc();
+    if (!scaled) {
+        throw std::runtime_error("Could not allocate scaled frame");
+    }
+    scaled->format = dstFormat;
+    scaled->width = dstWidth;
+    scaled->height = dstHeight;
+    if (av_frame_get_buffer(scaled, 0) < 0) {
+        av_frame_free(&scaled);
+        throw std::runtime_error("Could not allocate scaled frame buffer");
+    }
+    accountFrameBuffers(scaled);
+
+    workerScaler.context = sws_getCachedContext(workerScaler.context,
+        src->width, src->height, static_cast<AVPixelFormat>(src->format),
+        dstWidth, dstHeight, dstFormat,
+        SWS_BILINEAR, nullptr, nullptr, nullptr
+    );
+    if (!workerScaler.context) {
+        av_frame_free(&scaled);
+        throw std::runtime_error("Could not initialize scaling context");
+    }
+
+    sws_scale(workerScaler.context,
+             src->data, src->linesize, 0, src->height,
+             scaled->data, scaled->linesize);
+
+    // Keep timing (pts, duration) but let the encoder choose picture types
+    av_frame_copy_props(scaled, src);
+    scaled->pts = src->best_effort_timestamp;
+    scaled->pict_type = AV_PICTURE_TYPE_NONE;
+    return scaled;
+}
+
+// Best encoder pixel format for the source that swscale can also produce
+AVPixelFormat pickEncoderFormat(const AVCodec* encoder, AVPixelFormat sourceFormat) {
+    if (!encoder->pix_fmts) {
+        return AV_PIX_FMT_RGB24;
+    }
+    std::vector<AVPixelFormat> candidates;
+    for (const AVPixelFormat* format = encoder->pix_fmts; *format != AV_PIX_FMT_NONE; format++) {
+        if (sws_isSupportedOutput(*format)) {
+            candidates.push_back(*format);
+        }
+    }
+    if (candidates.empty()) {
+        throw std::runtime_error(std::string("No supported pixel format for encoder ") + encoder->name);
+    }
+    candidates.push_back(AV_PIX_FMT_NONE);
+    return avcodec_find_best_pix_fmt_of_list(candidates.data(), sourceFormat, 0, nullptr);
+}
+
+// Open the muxer and encoder implied by the output file extension (.gif, .webp, .apng, ...)
+void openAnimatedOutput(AnimatedOutput& output, const std::string& outputPath,
+                        int dstWidth, int dstHeight, AVRational timeBase, AVPixelFormat sourceFormat) {
+    avformat_alloc_output_context2(&output.formatContext, nullptr, nullptr, outputPath.c_str());
+    if (!output.formatContext) {
+        throw std::runtime_error("Could not deduce output format from file name: " + outputPath);
+    }
+
+    const AVCodec* codec = avcodec_find_encoder(output.formatContext->oformat->video_codec);
+    if (!codec) {
+        throw std::runtime_error("Could not find encoder for output file: " + outputPath);
+    }
+
+    output.encoder = avcodec_alloc_context3(codec);
+    if (!output.encoder) {
+        throw std::runtime_error("Could not allocate encoder context");
+    }
+    output.encoder->width = dstWidth;
+    output.encoder->height = dstHeight;
+    output.encoder->time_base = timeBase;
+    output.encoder->pix_fmt = pickEncoderFormat(codec, sourceFormat);
+    if (output.formatContext->oformat->flags & AVFMT_GLOBALHEADER) {
+        output.encoder->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    if (avcodec_open2(output.encoder, codec, nullptr) < 0) {
+        throw std::runtime_error("Could not open encoder for output file: " + outputPath);
+    }
+
+    output.stream = avformat_new_stream(output.formatContext, nullptr);
+    if (!output.stream) {
+        throw std::runtime_error("Could not allocate output stream");
+    }
+    avcodec_parameters_from_context(output.stream->codecpar, output.encoder);
+    output.stream->time_base = timeBase;
+
+    if (!(output.formatContext->oformat->flags & AVFMT_NOFILE) &&
+        avio_open(&output.formatContext->pb, outputPath.c_str(), AVIO_FLAG_WRITE) < 0) {
+        throw std::runtime_error("Could not open output file: " + outputPath);
+    }
+
+    if (avformat_write_header(output.formatContext, nullptr) < 0) {
+        throw std::runtime_error("Could not write output header");
+    }
+
+    output.packet = av_packet_alloc();
+    if (!output.packet) {
+        throw std::runtime_error("Could not allocate output packet");
+    }
+}
+
+} // namespace
 
 FFmpegResizer::~FFmpegResizer() {
     cleanup();
@@ -33,30 +337,135 @@ int FFmpegResizer::calculateHeight(int targetWidth, int originalWidth, int origi
 
 void FFmpegResizer::resizeWithPreset(const std::string& inputPath, const std::string& outputPath, ImageSize size) {
     int originalWidth, originalHeight;
-    if (!getOriginalDimensions(inputPath, originalWidth, originalHeight)) {
+    bool cached = frameCache && frameCache->sourceDimensions(inputPath, originalWidth, originalHeight);
+    // Probing through libav decodes the whole JPEG; with the thumbnail shortcut or the scaled
+    // libjpeg-turbo decode that would cost more than the resize itself, so JPEG dimensions
+    // come from the SOF header instead
+    std::vector<uint8_t> headers;
+    bool headerProbe = thumbnailPolicy.useExifThumbnail || jpegBackend == JpegBackend::TURBO;
+    bool fromHeaders = !cached && headerProbe && readJpegHeaders(inputPath, headers) &&
+                       readJpegDimensions(headers.data(), headers.size(), originalWidth, originalHeight);
+    if (!cached && !fromHeaders && !getOriginalDimensions(inputPath, originalWidth, originalHeight)) {
         throw std::runtime_error("Could not get original image dimensions");
     }
 
-    int targetWidth;
-    switch (size) {
-        case ImageSize::SMALL:
-            targetWidth = SMALL_WIDTH;
-            break;
-        case ImageSize::MEDIUM:
-            targetWidth = MEDIUM_WIDTH;
-            break;
-        case ImageSize::LARGE:
-            targetWidth = LARGE_WIDTH;
-            break;
-        default:
-            throw std::runtime_error("Invalid preset size");
+    int targetWidth = presetWidth(size);
+    if (targetWidth < 0) {
+        throw std::runtime_error("Invalid preset size");
     }
 
-    int targetHeight = calculateHeight(targetWidth, originalWidth, originalHeight);
+    CropRect region = cropRegion(originalWidth, originalHeight);
+    int targetHeight = calculateHeight(targetWidth, region.width, region.height);
     resize(inputPath, outputPath, targetWidth, targetHeight);
 }
 
-void FFmpegResizer::resize(const std::string& inputPath, const std::string& outputPath, int dstWidth, int dstHeight) {
+void FFmpegResizer::setFrameMode(FrameMode mode) {
+    frameMode = mode;
+}
+
+void FFmpegResizer::setThreadCount(unsigned threads) {
+    threadCount = threads;
+}
+
+void FFmpegResizer::setCenterCrop(int aspectWidth, int aspectHeight) {
+    if (aspectWidth <= 0 || aspectHeight <= 0) {
+        throw std::runtime_error("Invalid crop aspect ratio");
+    }
+    cropMode = CropMode::CENTER;
+    cropAspectWidth = aspectWidth;
+    cropAspectHeight = aspectHeight;
+}
+
+void FFmpegResizer::setCropRect(const CropRect& rect) {
+    if (rect.width <= 0 || rect.height <= 0) {
+        throw std::runtime_error("Invalid crop rectangle");
+    }
+    cropMode = CropMode::RECT;
+    cropRect = rect;
+}
+
+void FFmpegResizer::clearCrop() {
+    cropMode = CropMode::NONE;
+}
+
+CropRect FFmpegResizer::cropRegion(int width, int height) const {
+    CropRect region = {0, 0, width, height};
+
+    if (cropMode == CropMode::CENTER) {
+        // Largest rectangle with the requested aspect ratio that fits the frame
+        int64_t regionWidth = width;
+        int64_t regionHeight = static_cast<int64_t>(width) * cropAspectHeight / cropAspectWidth;
+        if (regionHeight > height) {
+            regionHeight = height;
+            regionWidth = static_cast<int64_t>(height) * cropAspectWidth / cropAspectHeight;
+        }
+        region.width = static_cast<int>(regionWidth);
+        region.height = static_cast<int>(regionHeight);
+        region.x = (width - region.width) / 2;
+        region.y = (height - region.height) / 2;
+    } else if (cropMode == CropMode::RECT) {
+        region.x = std::max(cropRect.x, 0);
+        region.y = std::max(cropRect.y, 0);
+        region.width = std::min(cropRect.x + cropRect.width, width) - region.x;
+        region.height = std::min(cropRect.y + cropRect.height, height) - region.y;
+    }
+
+    // Keep the origin on the chroma grid so subsampled planes stay in step with luma
+    region.width += region.x & 1;
+    region.height += region.y & 1;
+    region.x &= ~1;
+    region.y &= ~1;
+    region.width = std::min(region.width, width - region.x);
+    region.height = std::min(region.height, height - region.y);
+
+    if (region.width <= 0 || region.height <= 0) {
+        throw std::runtime_error("Crop region is outside the image");
+    }
+    return region;
+}
+
+void FFmpegResizer::applyCrop(AVFrame* frame) const {
+    if (cropMode == CropMode::NONE) {
+        return;
+    }
+
+    // Only the plane pointers and dimensions change; no pixels are copied
+    CropRect region = cropRegion(frame->width, frame->height);
+    frame->crop_left = region.x;
+    frame->crop_top = region.y;
+    frame->crop_right = frame->width - region.x - region.width;
+    frame->crop_bottom = frame->height - region.y - region.height;
+    if (av_frame_apply_cropping(frame, AV_FRAME_CROP_UNALIGNED) < 0) {
+        throw std::runtime_error("Could not crop frame");
+    }
+}
+
+void FFmpegResizer::setJpegBackend(JpegBackend backend) {
+    jpegCodec = createJpegCodec(backend);
+    jpegBackend = backend;
+}
+
+void FFmpegResizer::setJpegOptions(const JpegOptions& options) {
+    jpegOptions = options;
+}
+
+void FFmpegResizer::setThumbnailPolicy(const ThumbnailPolicy& policy) {
+    thumbnailPolicy = policy;
+}
+
+void FFmpegResizer::setMemoryLimit(int64_t bytes) {
+    memoryLimit = bytes;
+}
+
+const JobStats& FFmpegResizer::lastJobStats() const {
+    return lastStats;
+}
+
+void FFmpegResizer::setFrameCache(std::shared_ptr<FrameCache> cache) {
+    frameCache = cache;
+}
+
+void FFmpegResizer::openInput(const std::string& inputPath) {
     // Open input file and prepare input format context
     if (avformat_open_input(&inputFormatContext, inputPath.c_str(), nullptr, nullptr) != 0) {
         throw std::runtime_error("Error opening input file: " + inputPath);
@@ -90,6 +499,7 @@ void FFmpegResizer::resize(const std::string& inputPath, const std::string& outp
     if (avcodec_parameters_to_context(codecContext, codecParams) < 0) {
         throw std::runtime_error("Error copying codec parameters to codec context");
     }
+    accountDecoderBuffers(codecContext);
 
     if (avcodec_open2(codecContext, decoder, nullptr) < 0) {
         throw std::runtime_error("Error opening codec");
@@ -101,125 +511,411 @@ void FFmpegResizer::resize(const std::string& inputPath, const std::string& outp
     if (!frame || !packet) {
         throw std::runtime_error("Could not allocate frame or packet");
     }
+}
 
-    // Create scaling context
-    swsContext = sws_getContext(
-        codecContext->width, codecContext->height, codecContext->pix_fmt,
-        dstWidth, dstHeight, AV_PIX_FMT_RGB24,
-        SWS_BILINEAR, nullptr, nullptr, nullptr
-    );
-
-    if (!swsContext) {
-        throw std::runtime_error("Could not initialize scaling context");
-    }
-
-    // Allocate destination image buffer
+void FFmpegResizer::allocateDestination(int dstWidth, int dstHeight) {
     int ret = av_image_alloc(dstData, dstLinesize, dstWidth, dstHeight, AV_PIX_FMT_RGB24, 1);
     if (ret < 0) {
         throw std::runtime_error("Could not allocate destination image");
     }
+    dstBufferBytes = ret;
+    memoryCharge(dstBufferBytes);
+    memoryCheck();
+}
+
+void FFmpegResizer::resize(const std::string& inputPath, const std::string& outputPath, int dstWidth, int dstHeight) {
+    JobScope job(lastStats, memoryLimit);
+
+    if (frameMode == FrameMode::ALL) {
+        resizeAllFrames(inputPath, outputPath, dstWidth, dstHeight);
+        return;
+    }
+
+    if (frameCache && resizeFromCache(inputPath, outputPath, dstWidth, dstHeight)) {
+        return;
+    }
 
-    // Read frames
-    while (av_read_frame(inputFormatContext, packet) >= 0) {
-        if (packet->stream_index == videoStreamIndex) {
-            if (processPacket(dstWidth, dstHeight)) {
-                // Write output file (first frame only)
-                writeJPEG(outputPath, dstWidth, dstHeight);
-                break;
+    if (thumbnailPolicy.useExifThumbnail && resizeFromExifThumbnail(inputPath, outputPath, dstWidth, dstHeight)) {
+        return;
+    }
+
+    // Read before decoding: if the file is replaced meanwhile, the decoded pixels must not be
+    // cached under the new version's identity
+    FileIdentity sourceIdentity;
+    const FileIdentity* cacheIdentity =
+        frameCache && readFileIdentity(inputPath, sourceIdentity) ? &sourceIdentity : nullptr;
+
+    // libjpeg-turbo decodes JPEG files with its scaled IDCT, close to the target size. The
+    // size comes from the headers: opening the file through libav would decode it in full.
+    std::vector<uint8_t> headers;
+    int sourceWidth, sourceHeight;
+    bool scaledJpeg = jpegBackend == JpegBackend::TURBO && readJpegHeaders(inputPath, headers) &&
+                      readJpegDimensions(headers.data(), headers.size(), sourceWidth, sourceHeight);
+
+    try {
+        if (scaledJpeg) {
+            allocateDestination(dstWidth, dstHeight);
+            decodeScaledJpeg(inputPath, cacheIdentity, sourceWidth, sourceHeight, dstWidth, dstHeight);
+            writeJPEG(outputPath, dstWidth, dstHeight);
+        } else {
+            openInput(inputPath);
+
+            // Allocate destination image buffer
+            allocateDestination(dstWidth, dstHeight);
+
+            // Read frames
+            while (readPacket(inputFormatContext, packet) >= 0) {
+                if (packet->stream_index == videoStreamIndex) {
+                    if (processPacket(inputPath, cacheIdentity, dstWidth, dstHeight)) {
+                        // Write output file (first frame only)
+                        writeJPEG(outputPath, dstWidth, dstHeight);
+                        break;
+                    }
+                }
+                av_packet_unref(packet);
             }
         }
-        av_packet_unref(packet);
+    } catch (const std::exception& e) {
+        cleanup();
+        throw;
     }
+    cleanup();
+}
 
+void FFmpegResizer::resizeAllFrames(const std::string& inputPath, const std::string& outputPath, int dstWidth, int dstHeight) {
+    try {
+        openInput(inputPath);
+
+        AnimatedOutput output;
+        openAnimatedOutput(output, outputPath, dstWidth, dstHeight,
+                           inputFormatContext->streams[videoStreamIndex]->time_base, codecContext->pix_fmt);
+        AVPixelFormat dstFormat = output.encoder->pix_fmt;
+
+        // Decode and mux stay on this thread in stream order; only scaling and
+        // conversion fan out to the pool
+        FrameReorderBuffer reorder;
+        int64_t submitted = 0;
+        int64_t encoded = 0;
+        {
+            ThreadPool pool(threadCount);
+            const int64_t window = 2 * static_cast<int64_t>(pool.size());
+
+            // Encode every frame that is ready, in order, blocking while more than maxInFlight are pending
+            auto drain = [&](int64_t maxInFlight) {
+                while (encoded < submitted) {
+                    AVFrame* scaled = reorder.take(encoded, submitted - encoded > maxInFlight);
+                    if (!scaled) {
+                        return;
+                    }
+                    encoded++;
+                    try {
+                        output.encode(scaled);
+                    } catch (...) {
+                        av_frame_free(&scaled);
+                        throw;
+                    }
+                    av_frame_free(&scaled);
+                }
+            };
+
+            auto receiveFrame = [&]() {
+                TraceScope trace(TRACE_CATEGORY, "decode");
+                return avcodec_receive_frame(codecContext, frame);
+            };
+
+            auto decodeAndSubmit = [&](const AVPacket* pkt) {
+                {
+                    TraceScope trace(TRACE_CATEGORY, "decode");
+                    if (avcodec_send_packet(codecContext, pkt) < 0) {
+                        return;
+                    }
+                }
+                while (receiveFrame() >= 0) {
+                    memoryCheck();
+                    AVFrame* source = av_frame_clone(frame);
+                    av_frame_unref(frame);
+                    if (!source) {
+                        throw std::runtime_error("Could not reference decoded frame");
+                    }
+                    try {
+                        applyCrop(source);
+                    } catch (...) {
+                        av_frame_free(&source);
+                        throw;
+                    }
+
+                    int64_t sequence = submitted++;
+                    std::shared_ptr<MemoryAccount> account = MemoryScope::current();
+                    pool.submit([source, sequence, dstWidth, dstHeight, dstFormat, &reorder, account]() mutable {
+                        MemoryScope memoryScope(account);
+                        try {
+                            reorder.put(sequence, scaleForEncoder(source, dstWidth, dstHeight, dstFormat));
+                        } catch (...) {
+                            reorder.fail(std::current_exception());
+                        }
+                        av_frame_free(&source);
+                    });
+
+                    // Keep at most `window` frames in flight so memory stays bounded
+                    drain(window);
+                }
+            };
+
+            // Read frames
+            while (readPacket(inputFormatContext, packet) >= 0) {
+                if (packet->stream_index == videoStreamIndex) {
+                    decodeAndSubmit(packet);
+                }
+                av_packet_unref(packet);
+            }
+
+            // Flush the decoder and wait for the remaining frames
+            decodeAndSubmit(nullptr);
+            drain(0);
+        }
+
+        output.encode(nullptr);
+        if (av_write_trailer(output.formatContext) < 0) {
+            throw std::runtime_error("Could not write output trailer");
+        }
+    } catch (const std::exception& e) {
+        cleanup();
+        throw;
+    }
     cleanup();
 }
 
-bool FFmpegResizer::processPacket(int dstWidth, int dstHeight) {
-    int ret = avcodec_send_packet(codecContext, packet);
-    if (ret < 0) {
-        return false;
+bool FFmpegResizer::processPacket(const std::string& inputPath, const FileIdentity* cacheIdentity,
+                                  int dstWidth, int dstHeight) {
+    {
+        TraceScope trace(TRACE_CATEGORY, "decode");
+        int ret = avcodec_send_packet(codecContext, packet);
+        if (ret < 0) {
+            return false;
+        }
+
+        ret = avcodec_receive_frame(codecContext, frame);
+        if (ret < 0) {
+            return false;
+        }
     }
+    memoryCheck();
 
-    ret = avcodec_receive_frame(codecContext, frame);
-    if (ret < 0) {
+    // Cached before cropping, which only moves this frame's plane pointers
+    if (cacheIdentity) {
+        frameCache->insert(inputPath, *cacheIdentity, frame, frame->width, frame->height);
+    }
+    applyCrop(frame);
+
+    scaleFrame(frame, dstWidth, dstHeight);
+    return true;
+}
+
+void FFmpegResizer::decodeScaledJpeg(const std::string& inputPath, const FileIdentity* cacheIdentity,
+                                     int sourceWidth, int sourceHeight, int dstWidth, int dstHeight) {
+    std::vector<uint8_t> bytes;
+    {
+        TraceScope trace(TRACE_CATEGORY, "demux");
+        std::ifstream input(inputPath, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        if (!input.good() && !input.eof()) {
+            throw std::runtime_error("Error reading input file: " + inputPath);
+        }
+    }
+
+    int minWidth, minHeight;
+    minimumDecodeSize(sourceWidth, sourceHeight, dstWidth, dstHeight, minWidth, minHeight);
+
+    MemoryCharge inputCharge(bytes.size());
+    AVFrame* decoded = jpegCodec->decode(bytes.data(), bytes.size(), minWidth, minHeight);
+    try {
+        accountFrameBuffers(decoded);
+        memoryCheck();
+        // The reduced-size decode still serves any later output it covers
+        if (cacheIdentity) {
+            frameCache->insert(inputPath, *cacheIdentity, decoded, sourceWidth, sourceHeight);
+        }
+        applyCrop(decoded);
+        scaleFrame(decoded, dstWidth, dstHeight);
+    } catch (...) {
+        av_frame_free(&decoded);
+        throw;
+    }
+    av_frame_free(&decoded);
+}
+
+// The decoded image must stay large enough for the crop region to cover the target;
+// a caller-supplied rectangle is in source pixels, so it needs a full-size decode
+void FFmpegResizer::minimumDecodeSize(int sourceWidth, int sourceHeight, int dstWidth, int dstHeight,
+                                      int& minWidth, int& minHeight) const {
+    minWidth = sourceWidth;
+    minHeight = sourceHeight;
+    if (cropMode != CropMode::RECT) {
+        CropRect region = cropRegion(sourceWidth, sourceHeight);
+        minWidth = static_cast<int>(std::ceil(static_cast<double>(dstWidth) * sourceWidth / region.width));
+        minHeight = static_cast<int>(std::ceil(static_cast<double>(dstHeight) * sourceHeight / region.height));
+    }
+}
+
+bool FFmpegResizer::resizeFromCache(const std::string& inputPath, const std::string& outputPath, int dstWidth, int dstHeight) {
+    // With nothing cached yet the lookup only records the miss
+    int sourceWidth, sourceHeight;
+    int minWidth = std::numeric_limits<int>::max();
+    int minHeight = std::numeric_limits<int>::max();
+    if (frameCache->sourceDimensions(inputPath, sourceWidth, sourceHeight)) {
+        minimumDecodeSize(sourceWidth, sourceHeight, dstWidth, dstHeight, minWidth, minHeight);
+    }
+    AVFrame* cached = frameCache->lookup(inputPath, minWidth, minHeight);
+    if (!cached) {
         return false;
     }
 
-    // Scale the image
-    sws_scale(swsContext,
-             frame->data, frame->linesize, 0, codecContext->height,
-             dstData, dstLinesize);
+    // cached shares its pixels with the cache entry; cropping and scaling only read them
+    try {
+        allocateDestination(dstWidth, dstHeight);
+        applyCrop(cached);
+        scaleFrame(cached, dstWidth, dstHeight);
+        writeJPEG(outputPath, dstWidth, dstHeight);
+    } catch (...) {
+        av_frame_free(&cached);
+        cleanup();
+        throw;
+    }
+    av_frame_free(&cached);
+    cleanup();
     return true;
 }
 
-void FFmpegResizer::writeJPEG(const std::string& outputPath, int dstWidth, int dstHeight) {
-    const AVCodec* jpegCodec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
-    if (!jpegCodec) {
-        throw std::runtime_error("Could not find JPEG encoder");
+bool FFmpegResizer::resizeFromExifThumbnail(const std::string& inputPath, const std::string& outputPath, int dstWidth, int dstHeight) {
+    // A caller-supplied crop rectangle is in full-image pixels
+    if (cropMode == CropMode::RECT) {
+        return false;
+    }
+
+    std::vector<uint8_t> headers;
+    int sourceWidth, sourceHeight, thumbnailWidth, thumbnailHeight;
+    size_t offset, length;
+    if (!readJpegHeaders(inputPath, headers) ||
+        !readJpegDimensions(headers.data(), headers.size(), sourceWidth, sourceHeight) ||
+        !findExifThumbnail(headers.data(), headers.size(), offset, length) ||
+        !readJpegDimensions(headers.data() + offset, length, thumbnailWidth, thumbnailHeight)) {
+        return false;
     }
 
-    AVCodecContext* jpegContext = avcodec_alloc_context3(jpegCodec);
-    if (!jpegContext) {
-        throw std::runtime_error("Could not allocate JPEG context");
+    // Cameras often pad thumbnails to a fixed 4:3 or 16:9 box, and some editors leave a stale
+    // thumbnail behind after cropping; either shows up as an aspect mismatch
+    double sourceAspect = static_cast<double>(sourceWidth) / sourceHeight;
+    double thumbnailAspect = static_cast<double>(thumbnailWidth) / thumbnailHeight;
+    if (std::fabs(thumbnailAspect - sourceAspect) > thumbnailPolicy.aspectTolerance * sourceAspect) {
+        return false;
     }
 
-    jpegContext->width = dstWidth;
-    jpegContext->height = dstHeight;
-    jpegContext->time_base = AVRational{1, 25};
-    jpegContext->pix_fmt = AV_PIX_FMT_YUVJ420P;
-    jpegContext->codec_type = AVMEDIA_TYPE_VIDEO;
+    CropRect region = cropRegion(thumbnailWidth, thumbnailHeight);
+    if (region.width < dstWidth * thumbnailPolicy.minOversample ||
+        region.height < dstHeight * thumbnailPolicy.minOversample) {
+        return false;
+    }
 
-    if (avcodec_open2(jpegContext, jpegCodec, nullptr) < 0) {
-        avcodec_free_context(&jpegContext);
-        throw std::runtime_error("Could not open JPEG encoder");
+    // A thumbnail the decoder rejects falls back to the full image
+    AVFrame* decoded = nullptr;
+    try {
+        int minWidth = static_cast<int>(std::ceil(static_cast<double>(dstWidth) * thumbnailWidth / region.width));
+        int minHeight = static_cast<int>(std::ceil(static_cast<double>(dstHeight) * thumbnailHeight / region.height));
+        decoded = jpegCodec->decode(headers.data() + offset, length, minWidth, minHeight);
+    } catch (const std::exception&) {
+        return false;
     }
 
-    AVFrame* jpegFrame = av_frame_alloc();
-    jpegFrame->width = dstWidth;
-    jpegFrame->height = dstHeight;
-    jpegFrame->format = AV_PIX_FMT_YUVJ420P;
-    
-    if (av_frame_get_buffer(jpegFrame, 0) < 0) {
-        av_frame_free(&jpegFrame);
-        avcodec_free_context(&jpegContext);
-        throw std::runtime_error("Could not allocate JPEG frame buffer");
+    try {
+        accountFrameBuffers(decoded);
+        allocateDestination(dstWidth, dstHeight);
+        applyCrop(decoded);
+        scaleFrame(decoded, dstWidth, dstHeight);
+        writeJPEG(outputPath, dstWidth, dstHeight);
+    } catch (...) {
+        av_frame_free(&decoded);
+        cleanup();
+        throw;
     }
+    av_frame_free(&decoded);
+    cleanup();
+    return true;
+}
 
-    SwsContext* rgbToYuvContext = sws_getContext(
+void FFmpegResizer::scaleFrame(const AVFrame* src, int dstWidth, int dstHeight) {
+    TraceScope trace(TRACE_CATEGORY, "scale");
+    const AVFrame* scalerInput = src;
+
+    // Exact 2:1, 4:1 and 8:1 ratios are box-averaged plane by plane in the source format,
+    // leaving only the colorspace conversion for swscale
+    int factor = boxDownsampleFactor(src, dstWidth, dstHeight);
+    if (factor) {
+        if (!boxFrame || boxFrame->format != src->format ||
+            boxFrame->width != dstWidth || boxFrame->height != dstHeight) {
+            av_frame_free(&boxFrame);
+            boxFrame = av_frame_alloc();
+            if (!boxFrame) {
+                throw std::runtime_error("Could not allocate downsampling frame");
+            }
+            boxFrame->format = src->format;
+            boxFrame->width = dstWidth;
+            boxFrame->height = dstHeight;
+            if (av_frame_get_buffer(boxFrame, 0) < 0) {
+                throw std::runtime_error("Could not allocate downsampling frame buffer");
+            }
+            accountFrameBuffers(boxFrame);
+        }
+
+        AVPixelFormat format = static_cast<AVPixelFormat>(src->format);
+        const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+        for (int plane = 0; plane < av_pix_fmt_count_planes(format); plane++) {
+            bool chroma = plane == 1 || plane == 2;
+            fastscale::downsamplePlane(factor,
+                                       src->data[plane], src->linesize[plane],
+                                       boxFrame->data[plane], boxFrame->linesize[plane],
+                                       AV_CEIL_RSHIFT(dstWidth, chroma ? desc->log2_chroma_w : 0),
+                                       AV_CEIL_RSHIFT(dstHeight, chroma ? desc->log2_chroma_h : 0));
+        }
+        scalerInput = boxFrame;
+    }
+
+    // Create (or reuse) the scaling context for this input geometry
+    swsContext = sws_getCachedContext(swsContext,
+        scalerInput->width, scalerInput->height, static_cast<AVPixelFormat>(scalerInput->format),
         dstWidth, dstHeight, AV_PIX_FMT_RGB24,
-        dstWidth, dstHeight, AV_PIX_FMT_YUVJ420P,
         SWS_BILINEAR, nullptr, nullptr, nullptr
     );
 
-    sws_scale(rgbToYuvContext,
-             dstData, dstLinesize, 0, dstHeight,
-             jpegFrame->data, jpegFrame->linesize);
+    if (!swsContext) {
+        throw std::runtime_error("Could not initialize scaling context");
+    }
+
+    // Scale the image
+    sws_scale(swsContext,
+             scalerInput->data, scalerInput->linesize, 0, scalerInput->height,
+             dstData, dstLinesize);
+}
+
+void FFmpegResizer::writeJPEG(const std::string& outputPath, int dstWidth, int dstHeight) {
+    std::vector<uint8_t> jpeg;
+    jpegCodec->encode(dstData[0], dstLinesize[0], dstWidth, dstHeight, jpegOptions, jpeg);
+    MemoryCharge outputCharge(jpeg.size());
 
     FILE* outFile = fopen(outputPath.c_str(), "wb");
     if (!outFile) {
-        sws_freeContext(rgbToYuvContext);
-        av_frame_free(&jpegFrame);
-        avcodec_free_context(&jpegContext);
         throw std::runtime_error("Could not open output file");
     }
 
-    AVPacket* jpegPacket = av_packet_alloc();
-    
-    avcodec_send_frame(jpegContext, jpegFrame);
-    avcodec_receive_packet(jpegContext, jpegPacket);
-    
-    fwrite(jpegPacket->data, 1, jpegPacket->size, outFile);
-    
+    TraceScope trace(TRACE_CATEGORY, "write");
+    fwrite(jpeg.data(), 1, jpeg.size(), outFile);
     fclose(outFile);
-    av_packet_free(&jpegPacket);
-    sws_freeContext(rgbToYuvContext);
-    av_frame_free(&jpegFrame);
-    avcodec_free_context(&jpegContext);
 }
 
 void FFmpegResizer::cleanup() {
     if (dstData[0]) {
         av_freep(&dstData[0]);
+        memoryRelease(dstBufferBytes);
+        dstBufferBytes = 0;
     }
     if (swsContext) {
         sws_freeContext(swsContext);
@@ -228,6 +924,9 @@ void FFmpegResizer::cleanup() {
     if (frame) {
         av_frame_free(&frame);
     }
+    if (boxFrame) {
+        av_frame_free(&boxFrame);
+    }
     if (packet) {
         av_packet_free(&packet);
     }
@@ -237,4 +936,5 @@ void FFmpegResizer::cleanup() {
     if (inputFormatContext) {
         avformat_close_input(&inputFormatContext);
     }
+    videoStreamIndex = -1;
 }
\ No newline at end of file
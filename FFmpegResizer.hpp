@@ -7,6 +7,10 @@
 #include <cmath>
 #include <string>
 
+#include "FrameCache.hpp"
+#include "JobStats.hpp"
+#include "JpegCodec.hpp"
+
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
@@ -14,11 +18,6 @@ extern "C" {
 #include <libavutil/imgutils.h>
 }
 
-// Preset sizes
-const int SMALL_WIDTH = 250;
-const int MEDIUM_WIDTH = 350;
-const int LARGE_WIDTH = 650;
-
 enum class ImageSize {
     SMALL,
     MEDIUM,
@@ -26,6 +25,70 @@ enum class ImageSize {
     CUSTOM
 };
 
+// Preset sizes
+struct PresetSpec {
+    ImageSize size;
+    const char* name;
+    int width;
+};
+
+constexpr PresetSpec PRESETS[] = {
+    {ImageSize::SMALL, "small", 250},
+    {ImageSize::MEDIUM, "medium", 350},
+    {ImageSize::LARGE, "large", 650},
+};
+constexpr int PRESET_COUNT = sizeof(PRESETS) / sizeof(PRESETS[0]);
+
+constexpr int SMALL_WIDTH = PRESETS[0].width;
+constexpr int MEDIUM_WIDTH = PRESETS[1].width;
+constexpr int LARGE_WIDTH = PRESETS[2].width;
+
+// Width of a preset, or -1 if size is not in the table (e.g. CUSTOM)
+constexpr int presetWidth(ImageSize size, int index = 0) {
+    return index >= PRESET_COUNT ? -1
+         : PRESETS[index].size == size ? PRESETS[index].width
+         : presetWidth(size, index + 1);
+}
+
+static_assert(presetWidth(ImageSize::SMALL) < presetWidth(ImageSize::MEDIUM) &&
+              presetWidth(ImageSize::MEDIUM) < presetWidth(ImageSize::LARGE),
+              "Presets must be ordered from smallest to largest");
+
+// Look up a preset by its name ("small", "medium", "large")
+bool presetFromName(const std::string& name, ImageSize& size);
+
+// FIRST writes a still image from the first decoded frame; ALL resizes every frame
+// into an animated output whose container is chosen by the output file extension
+enum class FrameMode {
+    FIRST,
+    ALL
+};
+
+// Region of interest in source pixels
+struct CropRect {
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// NONE scales the whole frame; CENTER takes the largest centred region with the
+// requested aspect ratio; RECT takes a caller-supplied rectangle
+enum class CropMode {
+    NONE,
+    CENTER,
+    RECT
+};
+
+// Shortcut for small outputs from camera JPEGs: scale the thumbnail embedded in the EXIF
+// data instead of decoding the full image. The quality guard requires the thumbnail to be at
+// least minOversample times the output size, and aspectTolerance rejects letterboxed thumbnails.
+struct ThumbnailPolicy {
+    bool useExifThumbnail = false;
+    double minOversample = 1.0;
+    double aspectTolerance = 0.01;
+};
+
 class FFmpegResizer {
 private:
     AVFormatContext* inputFormatContext = nullptr;
@@ -33,11 +96,26 @@ private:
     SwsContext* swsContext = nullptr;
     AVFrame* frame = nullptr;
     AVPacket* packet = nullptr;
+    AVFrame* boxFrame = nullptr;
     uint8_t* dstData[4] = {nullptr};
     int dstLinesize[4] = {0};
+    int dstBufferBytes = 0;
     int videoStreamIndex = -1;
     int originalWidth = 0;
     int originalHeight = 0;
+    FrameMode frameMode = FrameMode::FIRST;
+    unsigned threadCount = 0;
+    CropMode cropMode = CropMode::NONE;
+    int cropAspectWidth = 0;
+    int cropAspectHeight = 0;
+    CropRect cropRect = {0, 0, 0, 0};
+    JpegBackend jpegBackend = JpegBackend::LIBAV;
+    JpegOptions jpegOptions;
+    std::unique_ptr<JpegCodec> jpegCodec = createJpegCodec(JpegBackend::LIBAV);
+    ThumbnailPolicy thumbnailPolicy;
+    int64_t memoryLimit = 0;
+    JobStats lastStats;
+    std::shared_ptr<FrameCache> frameCache;
 
 public:
     ~FFmpegResizer();
@@ -46,9 +124,47 @@ public:
     int calculateHeight(int targetWidth, int originalWidth, int originalHeight);
     void resizeWithPreset(const std::string& inputPath, const std::string& outputPath, ImageSize size);
     void resize(const std::string& inputPath, const std::string& outputPath, int dstWidth, int dstHeight);
-    
+
+    void setFrameMode(FrameMode mode);
+    // Worker threads for multi-frame scaling; 0 uses one per hardware thread
+    void setThreadCount(unsigned threads);
+
+    // Crop before scaling, e.g. setCenterCrop(1, 1) for square or setCenterCrop(16, 9) thumbnails
+    void setCenterCrop(int aspectWidth, int aspectHeight);
+    void setCropRect(const CropRect& rect);
+    void clearCrop();
+    // Region that will be passed to the scaler for a frame of the given size
+    CropRect cropRegion(int width, int height) const;
+
+    // Codec used to write JPEG output; TURBO also decodes JPEG input with scaled IDCT
+    void setJpegBackend(JpegBackend backend);
+    void setJpegOptions(const JpegOptions& options);
+
+    // Off by default; when on, JPEG inputs are also probed from their headers without a decode
+    void setThumbnailPolicy(const ThumbnailPolicy& policy);
+
+    // Cap on the memory one resize may account for (0 = no cap); a job over the cap throws
+    void setMemoryLimit(int64_t bytes);
+    // Wall time and memory use of the most recent resize
+    const JobStats& lastJobStats() const;
+
+    // Share decoded sources between resizes (nullptr disables); follow-up sizes of a cached
+    // input skip demux and decode. A cached frame stays charged to the job that decoded it.
+    void setFrameCache(std::shared_ptr<FrameCache> cache);
+
 private:
-    bool processPacket(int dstWidth, int dstHeight);
+    void openInput(const std::string& inputPath);
+    void allocateDestination(int dstWidth, int dstHeight);
+    void resizeAllFrames(const std::string& inputPath, const std::string& outputPath, int dstWidth, int dstHeight);
+    bool processPacket(const std::string& inputPath, const FileIdentity* cacheIdentity, int dstWidth, int dstHeight);
+    void applyCrop(AVFrame* frame) const;
+    void minimumDecodeSize(int sourceWidth, int sourceHeight, int dstWidth, int dstHeight,
+                           int& minWidth, int& minHeight) const;
+    bool resizeFromCache(const std::string& inputPath, const std::string& outputPath, int dstWidth, int dstHeight);
+    void decodeScaledJpeg(const std::string& inputPath, const FileIdentity* cacheIdentity,
+                          int sourceWidth, int sourceHeight, int dstWidth, int dstHeight);
+    bool resizeFromExifThumbnail(const std::string& inputPath, const std::string& outputPath, int dstWidth, int dstHeight);
+    void scaleFrame(const AVFrame* src, int dstWidth, int dstHeight);
     void writeJPEG(const std::string& outputPath, int dstWidth, int dstHeight);
     void cleanup();
 };
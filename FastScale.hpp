@@ -0,0 +1,101 @@
+#ifndef FAST_SCALE_HPP
+#define FAST_SCALE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Box (area) downsampling kernels for exact integer ratios on 8-bit planes.
+// Each output sample is the rounded mean of a Factor x Factor block of input
+// samples, which is what an area filter computes when the ratio is exact.
+
+namespace fastscale {
+
+// Returns 2, 4 or 8 when src is exactly that many times dst in both axes, 0 otherwise
+inline int exactDownscaleFactor(int srcWidth, int srcHeight, int dstWidth, int dstHeight) {
+    if (dstWidth <= 0 || dstHeight <= 0) {
+        return 0;
+    }
+    for (int factor : {2, 4, 8}) {
+        if (srcWidth == dstWidth * factor && srcHeight == dstHeight * factor) {
+            return factor;
+        }
+    }
+    return 0;
+}
+
+// Generic kernel: sum Factor rows vertically, then Factor columns horizontally.
+// Factor is a compile-time constant so both inner loops are fully unrolled.
+template <int Factor>
+inline void boxDownsamplePlane(const uint8_t* src, int srcStride,
+                               uint8_t* dst, int dstStride,
+                               int dstWidth, int dstHeight) {
+    static_assert(Factor == 4 || Factor == 8, "Use the 2:1 specialization for Factor 2");
+    constexpr int area = Factor * Factor;
+    constexpr int shift = Factor == 4 ? 4 : 6;
+
+    const int srcWidth = dstWidth * Factor;
+    std::vector<uint16_t> columnSums(srcWidth);
+
+    for (int y = 0; y < dstHeight; y++) {
+        const uint8_t* row = src + static_cast<std::ptrdiff_t>(y) * Factor * srcStride;
+        for (int x = 0; x < srcWidth; x++) {
+            columnSums[x] = row[x];
+        }
+        for (int r = 1; r < Factor; r++) {
+            row += srcStride;
+            for (int x = 0; x < srcWidth; x++) {
+                columnSums[x] += row[x];
+            }
+        }
+
+        uint8_t* out = dst + static_cast<std::ptrdiff_t>(y) * dstStride;
+        for (int x = 0; x < dstWidth; x++) {
+            const uint16_t* block = &columnSums[x * Factor];
+            unsigned sum = 0;
+            for (int c = 0; c < Factor; c++) {
+                sum += block[c];
+            }
+            out[x] = static_cast<uint8_t>((sum + area / 2) >> shift);
+        }
+    }
+}
+
+// 2:1 is the most common ratio, so it gets a dedicated two-row kernel
+// that needs no scratch buffer.
+template <>
+inline void boxDownsamplePlane<2>(const uint8_t* src, int srcStride,
+                                  uint8_t* dst, int dstStride,
+                                  int dstWidth, int dstHeight) {
+    for (int y = 0; y < dstHeight; y++) {
+        const uint8_t* top = src + static_cast<std::ptrdiff_t>(y) * 2 * srcStride;
+        const uint8_t* bottom = top + srcStride;
+        uint8_t* out = dst + static_cast<std::ptrdiff_t>(y) * dstStride;
+        for (int x = 0; x < dstWidth; x++) {
+            unsigned sum = top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1];
+            out[x] = static_cast<uint8_t>((sum + 2) >> 2);
+        }
+    }
+}
+
+// Runtime dispatch to the specialized kernels; returns false for unsupported factors
+inline bool downsamplePlane(int factor, const uint8_t* src, int srcStride,
+                            uint8_t* dst, int dstStride, int dstWidth, int dstHeight) {
+    switch (factor) {
+        case 2:
+            boxDownsamplePlane<2>(src, srcStride, dst, dstStride, dstWidth, dstHeight);
+            return true;
+        case 4:
+            boxDownsamplePlane<4>(src, srcStride, dst, dstStride, dstWidth, dstHeight);
+            return true;
+        case 8:
+            boxDownsamplePlane<8>(src, srcStride, dst, dstStride, dstWidth, dstHeight);
+            return true;
+        default:
+            return false;
+    }
+}
+
+} // namespace fastscale
+
+#endif // FAST_SCALE_HPP
@@ -0,0 +1,148 @@
+#include "FrameCache.hpp"
+
+#include <iterator>
+
+#include <sys/stat.h>
+
+namespace {
+
+int64_t frameBytes(const AVFrame* frame) {
+    int64_t bytes = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++) {
+        bytes += frame->buf[i]->size;
+    }
+    for (int i = 0; i < frame->nb_extended_buf; i++) {
+        bytes += frame->extended_buf[i]->size;
+    }
+    return bytes;
+}
+
+} // namespace
+
+bool FileIdentity::operator==(const FileIdentity& other) const {
+    return size == other.size && mtimeNanoseconds == other.mtimeNanoseconds &&
+           device == other.device && inode == other.inode;
+}
+
+bool FileIdentity::operator<(const FileIdentity& other) const {
+    if (size != other.size) {
+        return size < other.size;
+    }
+    if (mtimeNanoseconds != other.mtimeNanoseconds) {
+        return mtimeNanoseconds < other.mtimeNanoseconds;
+    }
+    if (device != other.device) {
+        return device < other.device;
+    }
+    return inode < other.inode;
+}
+
+bool readFileIdentity(const std::string& path, FileIdentity& identity) {
+    struct stat info;
+    if (stat(path.c_str(), &info) < 0 || !S_ISREG(info.st_mode)) {
+        return false;
+    }
+#ifdef __APPLE__
+    const struct timespec& mtime = info.st_mtimespec;
+#else
+    const struct timespec& mtime = info.st_mtim;
+#endif
+    identity.size = static_cast<int64_t>(info.st_size);
+    identity.mtimeNanoseconds = static_cast<int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec;
+    identity.device = static_cast<uint64_t>(info.st_dev);
+    identity.inode = static_cast<uint64_t>(info.st_ino);
+    return true;
+}
+
+FrameCache::FrameCache(int64_t byteBudget) : byteBudget(byteBudget) {}
+
+FrameCache::~FrameCache() {
+    for (Entry& entry : entries) {
+        av_frame_free(&entry.frame);
+    }
+}
+
+FrameCache::EntryIterator FrameCache::find(const std::string& path) {
+    auto it = index.find(path);
+    if (it == index.end()) {
+        return entries.end();
+    }
+    FileIdentity file;
+    if (!readFileIdentity(path, file) || !(file == it->second->file)) {
+        erase(it->second);
+        return entries.end();
+    }
+    return it->second;
+}
+
+void FrameCache::erase(EntryIterator entry) {
+    counters.bytes -= entry->bytes;
+    av_frame_free(&entry->frame);
+    index.erase(entry->path);
+    entries.erase(entry);
+}
+
+bool FrameCache::sourceDimensions(const std::string& path, int& width, int& height) {
+    std::lock_guard<std::mutex> lock(mutex);
+    EntryIterator entry = find(path);
+    if (entry == entries.end()) {
+        return false;
+    }
+    width = entry->sourceWidth;
+    height = entry->sourceHeight;
+    return true;
+}
+
+AVFrame* FrameCache::lookup(const std::string& path, int minWidth, int minHeight) {
+    std::lock_guard<std::mutex> lock(mutex);
+    EntryIterator entry = find(path);
+    AVFrame* frame = nullptr;
+    if (entry != entries.end() && entry->frame->width >= minWidth && entry->frame->height >= minHeight) {
+        frame = av_frame_clone(entry->frame);
+    }
+    if (!frame) {
+        counters.misses++;
+        return nullptr;
+    }
+    counters.hits++;
+    entries.splice(entries.begin(), entries, entry);
+    return frame;
+}
+
+void FrameCache::insert(const std::string& path, const FileIdentity& file, const AVFrame* frame,
+                        int sourceWidth, int sourceHeight) {
+    int64_t bytes = frameBytes(frame);
+    if (bytes > byteBudget) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // A surviving entry matches the file on disk; if it is not this version, this frame is stale
+    EntryIterator existing = find(path);
+    if (existing != entries.end()) {
+        if (!(existing->file == file) || existing->frame->width >= frame->width) {
+            return;
+        }
+        erase(existing);
+    }
+
+    AVFrame* reference = av_frame_clone(frame);
+    if (!reference) {
+        return;
+    }
+    entries.push_front(Entry{path, file, sourceWidth, sourceHeight, bytes, reference});
+    index[path] = entries.begin();
+    counters.bytes += bytes;
+
+    while (counters.bytes > byteBudget) {
+        erase(std::prev(entries.end()));
+        counters.evictions++;
+    }
+}
+
+FrameCache::Stats FrameCache::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats snapshot = counters;
+    snapshot.entries = static_cast<int64_t>(entries.size());
+    return snapshot;
+}
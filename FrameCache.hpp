@@ -0,0 +1,89 @@
+#ifndef FRAME_CACHE_HPP
+#define FRAME_CACHE_HPP
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// One version of a file on disk. The nanosecond mtime catches a same-size rewrite within the
+// same second; device and inode catch a replacement renamed over the old file.
+struct FileIdentity {
+    int64_t size = 0;
+    int64_t mtimeNanoseconds = 0;
+    uint64_t device = 0;
+    uint64_t inode = 0;
+
+    bool operator==(const FileIdentity& other) const;
+    bool operator<(const FileIdentity& other) const;
+};
+
+// False if path cannot be stat'ed or is not a regular file
+bool readFileIdentity(const std::string& path, FileIdentity& identity);
+
+// Bounded LRU cache of decoded source images, shared between resizers (and threads) so
+// follow-up sizes of the same input skip demux and decode. Entries are keyed by path and
+// validated against the file's current FileIdentity. Frames are shared by reference: a lookup
+// returns a new reference, so evicting an entry never pulls a frame from under a running job.
+class FrameCache {
+public:
+    struct Stats {
+        int64_t hits = 0;
+        int64_t misses = 0;
+        int64_t evictions = 0;
+        int64_t bytes = 0;
+        int64_t entries = 0;
+    };
+
+    // byteBudget bounds the pixel buffers held by the cache
+    explicit FrameCache(int64_t byteBudget);
+    ~FrameCache();
+
+    FrameCache(const FrameCache&) = delete;
+    FrameCache& operator=(const FrameCache&) = delete;
+
+    // Full-resolution size of a cached source, without touching the LRU order
+    bool sourceDimensions(const std::string& path, int& width, int& height);
+
+    // A new reference to the cached frame (free with av_frame_free), or nullptr if there is
+    // none at least minWidth x minHeight. Entries from a reduced-size decode can be smaller
+    // than the source.
+    AVFrame* lookup(const std::string& path, int minWidth, int minHeight);
+
+    // Cache a decoded frame of the file at path; sourceWidth/Height are its full-resolution size.
+    // file must be read before decoding starts, so a file replaced mid-decode is never cached
+    // under its new identity. An existing entry is only replaced by a larger decode.
+    void insert(const std::string& path, const FileIdentity& file, const AVFrame* frame,
+                int sourceWidth, int sourceHeight);
+
+    Stats stats();
+
+private:
+    struct Entry {
+        std::string path;
+        FileIdentity file;
+        int sourceWidth;
+        int sourceHeight;
+        int64_t bytes;
+        AVFrame* frame;
+    };
+    typedef std::list<Entry>::iterator EntryIterator;
+
+    // Entry for path if it still matches the file on disk; stale entries are dropped
+    EntryIterator find(const std::string& path);
+    void erase(EntryIterator entry);
+
+    std::mutex mutex;
+    int64_t byteBudget;
+    // Most recently used at the front
+    std::list<Entry> entries;
+    std::unordered_map<std::string, EntryIterator> index;
+    Stats counters;
+};
+
+#endif // FRAME_CACHE_HPP
@@ -0,0 +1,174 @@
+#include "JobStats.hpp"
+
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+thread_local std::shared_ptr<MemoryAccount> currentAccount;
+
+// A frame buffer reference standing in for the original, so the charge is
+// released exactly when the last reference to it goes away
+struct AccountedBuffer {
+    AVBufferRef* original;
+    std::shared_ptr<MemoryAccount> account;
+};
+
+void releaseAccountedBuffer(void* opaque, uint8_t*) {
+    AccountedBuffer* buffer = static_cast<AccountedBuffer*>(opaque);
+    buffer->account->release(buffer->original->size);
+    av_buffer_unref(&buffer->original);
+    delete buffer;
+}
+
+void wrapBuffer(AVBufferRef*& ref, const std::shared_ptr<MemoryAccount>& account) {
+    AccountedBuffer* buffer = new AccountedBuffer{ref, account};
+    int flags = av_buffer_is_writable(ref) ? 0 : AV_BUFFER_FLAG_READONLY;
+    AVBufferRef* wrapped = av_buffer_create(ref->data, ref->size, releaseAccountedBuffer, buffer, flags);
+    if (!wrapped) {
+        // Leave the buffer unaccounted rather than fail the decode
+        delete buffer;
+        return;
+    }
+    account->charge(ref->size);
+    ref = wrapped;
+}
+
+void wrapFrameBuffers(AVFrame* frame, const std::shared_ptr<MemoryAccount>& account) {
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++) {
+        wrapBuffer(frame->buf[i], account);
+    }
+    for (int i = 0; i < frame->nb_extended_buf; i++) {
+        wrapBuffer(frame->extended_buf[i], account);
+    }
+}
+
+// Runs on libav's decoding threads, so the account comes from the decoder rather than
+// the thread. Over-limit charges are reported by memoryCheck() at the next frame boundary.
+int accountedGetBuffer(AVCodecContext* decoder, AVFrame* frame, int flags) {
+    int ret = avcodec_default_get_buffer2(decoder, frame, flags);
+    if (ret >= 0 && decoder->opaque) {
+        wrapFrameBuffers(frame, static_cast<MemoryAccount*>(decoder->opaque)->shared_from_this());
+    }
+    return ret;
+}
+
+} // namespace
+
+MemoryAccount::MemoryAccount(int64_t limitBytes, std::shared_ptr<MemoryAccount> parent)
+    : parent(parent), limitBytes(limitBytes) {}
+
+bool MemoryAccount::charge(int64_t bytes) {
+    allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    int64_t live = liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    int64_t peak = peakBytes.load(std::memory_order_relaxed);
+    while (live > peak && !peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+
+    bool withinLimit = limitBytes <= 0 || live <= limitBytes;
+    if (!withinLimit) {
+        overLimit.store(true, std::memory_order_relaxed);
+    }
+    if (parent && !parent->charge(bytes)) {
+        withinLimit = false;
+    }
+    return withinLimit;
+}
+
+void MemoryAccount::release(int64_t bytes) {
+    liveBytes.fetch_sub(bytes, std::memory_order_relaxed);
+    if (parent) {
+        parent->release(bytes);
+    }
+}
+
+bool MemoryAccount::exceeded() const {
+    return overLimit.load(std::memory_order_relaxed) || (parent && parent->exceeded());
+}
+
+int64_t MemoryAccount::limit() const {
+    return limitBytes;
+}
+
+MemoryStats MemoryAccount::stats() const {
+    MemoryStats stats;
+    stats.allocatedBytes = allocatedBytes.load(std::memory_order_relaxed);
+    stats.peakBytes = peakBytes.load(std::memory_order_relaxed);
+    stats.liveBytes = liveBytes.load(std::memory_order_relaxed);
+    stats.allocations = allocations.load(std::memory_order_relaxed);
+    return stats;
+}
+
+MemoryScope::MemoryScope(std::shared_ptr<MemoryAccount> account) : previous(currentAccount) {
+    currentAccount = account;
+}
+
+MemoryScope::~MemoryScope() {
+    currentAccount = previous;
+}
+
+std::shared_ptr<MemoryAccount> MemoryScope::current() {
+    return currentAccount;
+}
+
+void memoryCharge(int64_t bytes) {
+    if (currentAccount) {
+        currentAccount->charge(bytes);
+    }
+}
+
+void memoryRelease(int64_t bytes) {
+    if (currentAccount) {
+        currentAccount->release(bytes);
+    }
+}
+
+void memoryCheck() {
+    if (currentAccount && currentAccount->exceeded()) {
+        throw std::runtime_error("Job exceeded its memory limit (peak " +
+                                 std::to_string(currentAccount->stats().peakBytes) + " bytes)");
+    }
+}
+
+void accountFrameBuffers(AVFrame* frame) {
+    if (currentAccount) {
+        wrapFrameBuffers(frame, currentAccount);
+    }
+}
+
+void accountPacketBuffer(AVPacket* packet) {
+    if (currentAccount && packet->buf) {
+        wrapBuffer(packet->buf, currentAccount);
+    }
+}
+
+void accountDecoderBuffers(AVCodecContext* decoder) {
+    if (currentAccount) {
+        decoder->opaque = currentAccount.get();
+        decoder->get_buffer2 = accountedGetBuffer;
+    }
+}
+
+MemoryCharge::MemoryCharge(int64_t bytes) : bytes(currentAccount ? bytes : 0) {
+    if (currentAccount && !currentAccount->charge(this->bytes)) {
+        currentAccount->release(this->bytes);
+        memoryCheck();
+    }
+}
+
+MemoryCharge::~MemoryCharge() {
+    memoryRelease(bytes);
+}
+
+JobScope::JobScope(JobStats& stats, int64_t memoryLimit)
+    : stats(stats),
+      account(std::make_shared<MemoryAccount>(memoryLimit, MemoryScope::current())),
+      memoryScope(account),
+      start(std::chrono::steady_clock::now()) {}
+
+JobScope::~JobScope() {
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    stats.wallMilliseconds = elapsed.count();
+    stats.memory = account->stats();
+}
@@ -0,0 +1,112 @@
+#ifndef JOB_STATS_HPP
+#define JOB_STATS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+// libav has no per-thread allocator hooks, so memory is accounted at buffer boundaries:
+// decoded frames (through the decoder's get_buffer2), frames we allocate for scaling and
+// encoding, and our own image/bitstream buffers. Codec and scaler internals are not counted.
+struct MemoryStats {
+    int64_t allocatedBytes = 0;  // Total bytes charged over the job
+    int64_t peakBytes = 0;       // Highest number of bytes live at once
+    int64_t liveBytes = 0;       // Bytes still charged (normally 0 once the job has finished)
+    int64_t allocations = 0;
+};
+
+// Byte counters for one job. Charges also count against the parent, so a job that runs
+// inside another (e.g. thumbnail resizes during a video job) shows up in both.
+class MemoryAccount : public std::enable_shared_from_this<MemoryAccount> {
+public:
+    explicit MemoryAccount(int64_t limitBytes = 0, std::shared_ptr<MemoryAccount> parent = nullptr);
+
+    // Returns false once live bytes exceed the limit (here or in a parent); the charge is kept
+    bool charge(int64_t bytes);
+    void release(int64_t bytes);
+
+    bool exceeded() const;
+    int64_t limit() const;
+    MemoryStats stats() const;
+
+private:
+    std::shared_ptr<MemoryAccount> parent;
+    int64_t limitBytes;
+    std::atomic<int64_t> allocatedBytes{0};
+    std::atomic<int64_t> peakBytes{0};
+    std::atomic<int64_t> liveBytes{0};
+    std::atomic<int64_t> allocations{0};
+    std::atomic<bool> overLimit{false};
+};
+
+// Routes this thread's memory hooks to account until destroyed; worker threads adopt the
+// job's account with their own MemoryScope
+class MemoryScope {
+public:
+    explicit MemoryScope(std::shared_ptr<MemoryAccount> account);
+    ~MemoryScope();
+
+    MemoryScope(const MemoryScope&) = delete;
+    MemoryScope& operator=(const MemoryScope&) = delete;
+
+    // Account active on this thread, or nullptr
+    static std::shared_ptr<MemoryAccount> current();
+
+private:
+    std::shared_ptr<MemoryAccount> previous;
+};
+
+// Hooks; all of them are no-ops on a thread without a MemoryScope
+void memoryCharge(int64_t bytes);
+void memoryRelease(int64_t bytes);
+// Throws if the current job has gone over its memory limit
+void memoryCheck();
+
+// Charge the frame's buffers to the current account until their last reference is dropped
+void accountFrameBuffers(AVFrame* frame);
+// Same for an encoded packet that is held in memory
+void accountPacketBuffer(AVPacket* packet);
+// Charge every frame the decoder allocates to the current account. The decoder must be
+// freed before the account's job ends.
+void accountDecoderBuffers(AVCodecContext* decoder);
+
+// Charges bytes for the lifetime of the object; throws (and drops the charge) if that breaks the limit
+class MemoryCharge {
+public:
+    explicit MemoryCharge(int64_t bytes);
+    ~MemoryCharge();
+
+    MemoryCharge(const MemoryCharge&) = delete;
+    MemoryCharge& operator=(const MemoryCharge&) = delete;
+
+private:
+    int64_t bytes;
+};
+
+struct JobStats {
+    double wallMilliseconds = 0;
+    MemoryStats memory;
+};
+
+// Times a job and accounts its memory on the calling thread. memoryLimit = 0 means no cap.
+class JobScope {
+public:
+    JobScope(JobStats& stats, int64_t memoryLimit);
+    ~JobScope();
+
+    JobScope(const JobScope&) = delete;
+    JobScope& operator=(const JobScope&) = delete;
+
+private:
+    JobStats& stats;
+    std::shared_ptr<MemoryAccount> account;
+    MemoryScope memoryScope;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif // JOB_STATS_HPP
@@ -0,0 +1,481 @@
+#include "JpegCodec.hpp"
+#include "Tracer.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+#include <libswscale/swscale.h>
+}
+
+#ifdef HAVE_LIBJPEG_TURBO
+#include <csetjmp>
+extern "C" {
+#include <jpeglib.h>
+}
+#endif
+
+static const char* const TRACE_CATEGORY = "JpegCodec";
+
+int jpegScaleDenominator(int width, int height, int minWidth, int minHeight) {
+    for (int shift = 3; shift > 0; shift--) {
+        if (AV_CEIL_RSHIFT(width, shift) >= minWidth && AV_CEIL_RSHIFT(height, shift) >= minHeight) {
+            return 1 << shift;
+        }
+    }
+    return 1;
+}
+
+bool jpegBackendAvailable(JpegBackend backend) {
+#ifdef HAVE_LIBJPEG_TURBO
+    (void)backend;
+    return true;
+#else
+    return backend == JpegBackend::LIBAV;
+#endif
+}
+
+bool jpegBackendFromName(const std::string& name, JpegBackend& backend) {
+    if (name == "libav") {
+        backend = JpegBackend::LIBAV;
+        return true;
+    }
+    if (name == "turbo") {
+        backend = JpegBackend::TURBO;
+        return true;
+    }
+    return false;
+}
+
+// Read the frame size from the first SOF marker
+bool readJpegDimensions(const uint8_t* data, size_t size, int& width, int& height) {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return false;
+    }
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) {
+            return false;
+        }
+        uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            pos += 2;
+            continue;
+        }
+        size_t length = (data[pos + 2] << 8) | data[pos + 3];
+        bool startOfFrame = marker >= 0xC0 && marker <= 0xCF &&
+                            marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (startOfFrame) {
+            if (pos + 9 > size) {
+                return false;
+            }
+            height = (data[pos + 5] << 8) | data[pos + 6];
+            width = (data[pos + 7] << 8) | data[pos + 8];
+            return width > 0 && height > 0;
+        }
+        pos += 2 + length;
+    }
+    return false;
+}
+
+// TIFF fields in the byte order given by the EXIF header ("II" little-endian, "MM" big-endian)
+static uint32_t readTiff(const uint8_t* p, int bytes, bool littleEndian) {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= static_cast<uint32_t>(p[i]) << (8 * (littleEndian ? i : bytes - 1 - i));
+    }
+    return value;
+}
+
+bool findExifThumbnail(const uint8_t* data, size_t size, size_t& offset, size_t& length) {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return false;
+    }
+    size_t pos = 2;
+    while (pos + 4 <= size && data[pos] == 0xFF) {
+        uint8_t marker = data[pos + 1];
+        if (marker == 0xDA || marker == 0xD9) {
+            return false;  // EXIF lives before the scan data
+        }
+        size_t segmentLength = (data[pos + 2] << 8) | data[pos + 3];
+        size_t segmentEnd = std::min(size, pos + 2 + segmentLength);
+        if (marker != 0xE1 || segmentLength < 8 || pos + 10 > segmentEnd || std::memcmp(data + pos + 4, "Exif\0\0", 6) != 0) {
+            pos += 2 + segmentLength;
+            continue;
+        }
+
+        // Offsets inside EXIF are relative to the TIFF header that follows "Exif\0\0"
+        const uint8_t* tiff = data + pos + 10;
+        size_t tiffSize = segmentEnd - (pos + 10);
+        if (tiffSize < 8 || !((tiff[0] == 'I' && tiff[1] == 'I') || (tiff[0] == 'M' && tiff[1] == 'M'))) {
+            return false;
+        }
+        bool littleEndian = tiff[0] == 'I';
+
+        // IFD0 describes the main image; the link after its entries points at IFD1, the thumbnail
+        size_t ifd0 = readTiff(tiff + 4, 4, littleEndian);
+        if (ifd0 + 2 > tiffSize) {
+            return false;
+        }
+        size_t entries = readTiff(tiff + ifd0, 2, littleEndian);
+        if (ifd0 + 2 + entries * 12 + 4 > tiffSize) {
+            return false;
+        }
+        size_t ifd1 = readTiff(tiff + ifd0 + 2 + entries * 12, 4, littleEndian);
+        if (ifd1 == 0 || ifd1 + 2 > tiffSize) {
+            return false;
+        }
+        entries = readTiff(tiff + ifd1, 2, littleEndian);
+        if (ifd1 + 2 + entries * 12 > tiffSize) {
+            return false;
+        }
+
+        size_t thumbnailOffset = 0;
+        size_t thumbnailLength = 0;
+        for (size_t i = 0; i < entries; i++) {
+            const uint8_t* entry = tiff + ifd1 + 2 + i * 12;
+            uint32_t tag = readTiff(entry, 2, littleEndian);
+            if (tag == 0x0201) {         // JPEGInterchangeFormat
+                thumbnailOffset = readTiff(entry + 8, 4, littleEndian);
+            } else if (tag == 0x0202) {  // JPEGInterchangeFormatLength
+                thumbnailLength = readTiff(entry + 8, 4, littleEndian);
+            }
+        }
+        if (thumbnailOffset == 0 || thumbnailLength < 4 ||
+            thumbnailOffset > tiffSize || thumbnailLength > tiffSize - thumbnailOffset) {
+            return false;
+        }
+        const uint8_t* thumbnail = tiff + thumbnailOffset;
+        if (thumbnail[0] != 0xFF || thumbnail[1] != 0xD8) {
+            return false;  // Uncompressed (TIFF strip) thumbnails are not supported
+        }
+        offset = static_cast<size_t>(thumbnail - data);
+        length = thumbnailLength;
+        return true;
+    }
+    return false;
+}
+
+class LibavJpegCodec : public JpegCodec {
+public:
+    const char* name() const override {
+        return "libav";
+    }
+
+    void encode(const uint8_t* rgb, int linesize, int width, int height,
+                const JpegOptions& options, std::vector<uint8_t>& jpeg) override {
+        const AVCodec* jpegCodec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+        if (!jpegCodec) {
+            throw std::runtime_error("Could not find JPEG encoder");
+        }
+
+        AVCodecContext* jpegContext = avcodec_alloc_context3(jpegCodec);
+        if (!jpegContext) {
+            throw std::runtime_error("Could not allocate JPEG context");
+        }
+
+        jpegContext->width = width;
+        jpegContext->height = height;
+        jpegContext->time_base = AVRational{1, 25};
+        jpegContext->pix_fmt = AV_PIX_FMT_YUVJ420P;
+        jpegContext->codec_type = AVMEDIA_TYPE_VIDEO;
+
+        // Map libjpeg-style quality 1-100 onto MJPEG qscale 31-2
+        int quality = std::min(std::max(options.quality, 1), 100);
+        jpegContext->flags |= AV_CODEC_FLAG_QSCALE;
+        jpegContext->global_quality = FF_QP2LAMBDA * (2 + (100 - quality) * 29 / 99);
+        av_opt_set(jpegContext->priv_data, "huffman", options.optimizeCoding ? "optimal" : "default", 0);
+
+        if (avcodec_open2(jpegContext, jpegCodec, nullptr) < 0) {
+            avcodec_free_context(&jpegContext);
+            throw std::runtime_error("Could not open JPEG encoder");
+        }
+
+        AVFrame* jpegFrame = av_frame_alloc();
+        AVPacket* jpegPacket = av_packet_alloc();
+        SwsContext* rgbToYuvContext = nullptr;
+        auto release = [&]() {
+            sws_freeContext(rgbToYuvContext);
+            av_packet_free(&jpegPacket);
+            av_frame_free(&jpegFrame);
+            avcodec_free_context(&jpegContext);
+        };
+
+        if (!jpegFrame || !jpegPacket) {
+            release();
+            throw std::runtime_error("Could not allocate JPEG frame or packet");
+        }
+        jpegFrame->width = width;
+        jpegFrame->height = height;
+        jpegFrame->format = AV_PIX_FMT_YUVJ420P;
+        jpegFrame->quality = jpegContext->global_quality;
+        if (av_frame_get_buffer(jpegFrame, 0) < 0) {
+            release();
+            throw std::runtime_error("Could not allocate JPEG frame buffer");
+        }
+
+        rgbToYuvContext = sws_getContext(
+            width, height, AV_PIX_FMT_RGB24,
+            width, height, AV_PIX_FMT_YUVJ420P,
+            SWS_BILINEAR, nullptr, nullptr, nullptr
+        );
+        if (!rgbToYuvContext) {
+            release();
+            throw std::runtime_error("Could not initialize colorspace conversion");
+        }
+
+        {
+            TraceScope trace(TRACE_CATEGORY, "colorspace");
+            const uint8_t* srcData[4] = {rgb, nullptr, nullptr, nullptr};
+            int srcLinesize[4] = {linesize, 0, 0, 0};
+            sws_scale(rgbToYuvContext, srcData, srcLinesize, 0, height,
+                      jpegFrame->data, jpegFrame->linesize);
+        }
+
+        {
+            TraceScope trace(TRACE_CATEGORY, "encode");
+            if (avcodec_send_frame(jpegContext, jpegFrame) < 0 ||
+                avcodec_receive_packet(jpegContext, jpegPacket) < 0) {
+                release();
+                throw std::runtime_error("Error encoding JPEG");
+            }
+        }
+
+        jpeg.assign(jpegPacket->data, jpegPacket->data + jpegPacket->size);
+        release();
+    }
+
+    AVFrame* decode(const uint8_t* data, size_t size, int minWidth, int minHeight) override {
+        int width = 0;
+        int height = 0;
+        if (!readJpegDimensions(data, size, width, height)) {
+            throw std::runtime_error("Not a JPEG bitstream");
+        }
+
+        const AVCodec* decoder = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
+        if (!decoder) {
+            throw std::runtime_error("Could not find JPEG decoder");
+        }
+        AVCodecContext* decoderContext = avcodec_alloc_context3(decoder);
+        AVPacket* packet = av_packet_alloc();
+        AVFrame* decoded = av_frame_alloc();
+        AVFrame* rgb = av_frame_alloc();
+        SwsContext* toRgbContext = nullptr;
+        auto release = [&]() {
+            sws_freeContext(toRgbContext);
+            av_frame_free(&decoded);
+            av_packet_free(&packet);
+            avcodec_free_context(&decoderContext);
+        };
+
+        if (!decoderContext || !packet || !decoded || !rgb) {
+            av_frame_free(&rgb);
+            release();
+            throw std::runtime_error("Could not allocate JPEG decoder");
+        }
+
+        // lowres decodes at 1/2, 1/4 or 1/8 scale straight from the DCT coefficients
+        int denominator = jpegScaleDenominator(width, height, minWidth, minHeight);
+        decoderContext->lowres = denominator == 8 ? 3 : denominator == 4 ? 2 : denominator == 2 ? 1 : 0;
+
+        try {
+            if (avcodec_open2(decoderContext, decoder, nullptr) < 0) {
+                throw std::runtime_error("Could not open JPEG decoder");
+            }
+            if (av_new_packet(packet, static_cast<int>(size)) < 0) {
+                throw std::runtime_error("Could not allocate JPEG packet");
+            }
+            memcpy(packet->data, data, size);
+
+            {
+                TraceScope trace(TRACE_CATEGORY, "decode");
+                if (avcodec_send_packet(decoderContext, packet) < 0) {
+                    throw std::runtime_error("Error decoding JPEG");
+                }
+                int ret = avcodec_receive_frame(decoderContext, decoded);
+                if (ret == AVERROR(EAGAIN)) {
+                    avcodec_send_packet(decoderContext, nullptr);
+                    ret = avcodec_receive_frame(decoderContext, decoded);
+                }
+                if (ret < 0) {
+                    throw std::runtime_error("Error decoding JPEG");
+                }
+            }
+
+            rgb->format = AV_PIX_FMT_RGB24;
+            rgb->width = decoded->width;
+            rgb->height = decoded->height;
+            if (av_frame_get_buffer(rgb, 0) < 0) {
+                throw std::runtime_error("Could not allocate RGB frame");
+            }
+
+            toRgbContext = sws_getContext(
+                decoded->width, decoded->height, static_cast<AVPixelFormat>(decoded->format),
+                decoded->width, decoded->height, AV_PIX_FMT_RGB24,
+                SWS_BILINEAR, nullptr, nullptr, nullptr
+            );
+            if (!toRgbContext) {
+                throw std::runtime_error("Could not initialize colorspace conversion");
+            }
+
+            TraceScope trace(TRACE_CATEGORY, "colorspace");
+            sws_scale(toRgbContext, decoded->data, decoded->linesize, 0, decoded->height,
+                      rgb->data, rgb->linesize);
+        } catch (...) {
+            av_frame_free(&rgb);
+            release();
+            throw;
+        }
+
+        release();
+        return rgb;
+    }
+};
+
+#ifdef HAVE_LIBJPEG_TURBO
+
+// libjpeg reports fatal errors through error_exit, which must not return;
+// jump back to the caller so it can clean up and throw
+struct TurboErrorManager {
+    jpeg_error_mgr base;
+    std::jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+// Output of jpeg_mem_dest, freed with the owner
+struct TurboDestination {
+    unsigned char* buffer = nullptr;
+    unsigned long size = 0;
+
+    ~TurboDestination() {
+        free(buffer);
+    }
+};
+
+static void turboErrorExit(j_common_ptr info) {
+    TurboErrorManager* error = reinterpret_cast<TurboErrorManager*>(info->err);
+    (*info->err->format_message)(info, error->message);
+    std::longjmp(error->jump, 1);
+}
+
+class TurboJpegCodec : public JpegCodec {
+public:
+    const char* name() const override {
+        return "turbo";
+    }
+
+    void encode(const uint8_t* rgb, int linesize, int width, int height,
+                const JpegOptions& options, std::vector<uint8_t>& jpeg) override {
+        TraceScope trace(TRACE_CATEGORY, "encode");
+
+        jpeg_compress_struct info;
+        TurboErrorManager error;
+        // libjpeg writes the buffer pointer after setjmp, so it must not be a local of this frame:
+        // the pointer to the heap object is set before and stays valid once longjmp returns
+        std::unique_ptr<TurboDestination> destination(new TurboDestination);
+
+        info.err = jpeg_std_error(&error.base);
+        error.base.error_exit = turboErrorExit;
+        if (setjmp(error.jump)) {
+            jpeg_destroy_compress(&info);
+            throw std::runtime_error(std::string("Error encoding JPEG: ") + error.message);
+        }
+
+        jpeg_create_compress(&info);
+        jpeg_mem_dest(&info, &destination->buffer, &destination->size);
+
+        info.image_width = width;
+        info.image_height = height;
+        info.input_components = 3;
+        info.in_color_space = JCS_RGB;
+        jpeg_set_defaults(&info);
+        jpeg_set_quality(&info, std::min(std::max(options.quality, 1), 100), TRUE);
+        info.optimize_coding = options.optimizeCoding ? TRUE : FALSE;
+        if (options.progressive) {
+            jpeg_simple_progression(&info);
+        }
+
+        jpeg_start_compress(&info, TRUE);
+        while (info.next_scanline < info.image_height) {
+            JSAMPROW row = const_cast<JSAMPROW>(rgb + static_cast<size_t>(info.next_scanline) * linesize);
+            jpeg_write_scanlines(&info, &row, 1);
+        }
+        jpeg_finish_compress(&info);
+        jpeg_destroy_compress(&info);
+
+        // May throw; destination still owns the buffer
+        jpeg.assign(destination->buffer, destination->buffer + destination->size);
+    }
+
+    AVFrame* decode(const uint8_t* data, size_t size, int minWidth, int minHeight) override {
+        TraceScope trace(TRACE_CATEGORY, "decode");
+
+        jpeg_decompress_struct info;
+        TurboErrorManager error;
+        // Allocated before setjmp: a local assigned afterwards is indeterminate once longjmp returns
+        AVFrame* rgb = av_frame_alloc();
+        if (!rgb) {
+            throw std::runtime_error("Could not allocate RGB frame");
+        }
+
+        info.err = jpeg_std_error(&error.base);
+        error.base.error_exit = turboErrorExit;
+        if (setjmp(error.jump)) {
+            jpeg_destroy_decompress(&info);
+            av_frame_free(&rgb);
+            throw std::runtime_error(std::string("Error decoding JPEG: ") + error.message);
+        }
+
+        jpeg_create_decompress(&info);
+        jpeg_mem_src(&info, const_cast<unsigned char*>(data), static_cast<unsigned long>(size));
+        jpeg_read_header(&info, TRUE);
+
+        // Scaled IDCT: decode directly at 1/2, 1/4 or 1/8 size when the target allows it
+        info.scale_num = 1;
+        info.scale_denom = jpegScaleDenominator(info.image_width, info.image_height, minWidth, minHeight);
+        info.out_color_space = JCS_RGB;
+        jpeg_start_decompress(&info);
+
+        rgb->format = AV_PIX_FMT_RGB24;
+        rgb->width = info.output_width;
+        rgb->height = info.output_height;
+        if (av_frame_get_buffer(rgb, 0) < 0) {
+            jpeg_destroy_decompress(&info);
+            av_frame_free(&rgb);
+            throw std::runtime_error("Could not allocate RGB frame buffer");
+        }
+
+        while (info.output_scanline < info.output_height) {
+            JSAMPROW row = rgb->data[0] + static_cast<size_t>(info.output_scanline) * rgb->linesize[0];
+            jpeg_read_scanlines(&info, &row, 1);
+        }
+        jpeg_finish_decompress(&info);
+        jpeg_destroy_decompress(&info);
+        return rgb;
+    }
+};
+
+#endif // HAVE_LIBJPEG_TURBO
+
+std::unique_ptr<JpegCodec> createJpegCodec(JpegBackend backend) {
+    switch (backend) {
+        case JpegBackend::LIBAV:
+            return std::unique_ptr<JpegCodec>(new LibavJpegCodec);
+        case JpegBackend::TURBO:
+#ifdef HAVE_LIBJPEG_TURBO
+            return std::unique_ptr<JpegCodec>(new TurboJpegCodec);
+#else
+            throw std::runtime_error("libjpeg-turbo backend not built (compile with -DHAVE_LIBJPEG_TURBO)");
+#endif
+    }
+    throw std::runtime_error("Invalid JPEG backend");
+}
@@ -0,0 +1,56 @@
+#ifndef JPEG_CODEC_HPP
+#define JPEG_CODEC_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Still-image JPEG backends. LIBAV uses libavcodec's MJPEG encoder/decoder;
+// TURBO uses libjpeg-turbo and is only available when built with HAVE_LIBJPEG_TURBO.
+enum class JpegBackend {
+    LIBAV,
+    TURBO
+};
+
+struct JpegOptions {
+    int quality = 90;             // 1-100, as in libjpeg
+    bool optimizeCoding = true;   // Optimal Huffman tables (smaller files, slightly slower)
+    bool progressive = false;     // TURBO only; libav's MJPEG encoder is baseline-only
+};
+
+class JpegCodec {
+public:
+    virtual ~JpegCodec() = default;
+
+    virtual const char* name() const = 0;
+
+    // Encode packed RGB24 rows into a JPEG bitstream
+    virtual void encode(const uint8_t* rgb, int linesize, int width, int height,
+                        const JpegOptions& options, std::vector<uint8_t>& jpeg) = 0;
+
+    // Decode a JPEG bitstream into a refcounted RGB24 frame (free with av_frame_free).
+    // The decoder may downscale by 2, 4 or 8 while staying at least minWidth x minHeight.
+    virtual AVFrame* decode(const uint8_t* data, size_t size, int minWidth, int minHeight) = 0;
+};
+
+std::unique_ptr<JpegCodec> createJpegCodec(JpegBackend backend);
+bool jpegBackendAvailable(JpegBackend backend);
+// Look up a backend by name ("libav", "turbo")
+bool jpegBackendFromName(const std::string& name, JpegBackend& backend);
+
+// Frame size from the first SOF marker of a JPEG bitstream
+bool readJpegDimensions(const uint8_t* data, size_t size, int& width, int& height);
+
+// Locate the JPEG thumbnail embedded in the EXIF (APP1) segment; offset and length are
+// relative to data. Only the headers before the first scan need to be present.
+bool findExifThumbnail(const uint8_t* data, size_t size, size_t& offset, size_t& length);
+
+// Largest power-of-two reduction (1, 2, 4 or 8) that keeps the image at least minWidth x minHeight
+int jpegScaleDenominator(int width, int height, int minWidth, int minHeight);
+
+#endif // JPEG_CODEC_HPP
@@ -0,0 +1,156 @@
+#include "Tracer.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+    const char* category;
+    const char* name;
+    int64_t beginNs;
+    int64_t endNs;
+};
+
+// Fixed-size block of events. Only the owning thread writes; count and next are
+// published with release stores so the dump can read a buffer while it grows.
+struct TraceChunk {
+    static const size_t CAPACITY = 4096;
+    TraceEvent events[CAPACITY];
+    std::atomic<size_t> count{0};
+    std::atomic<TraceChunk*> next{nullptr};
+};
+
+struct ThreadBuffer {
+    int tid;
+    TraceChunk* head;
+    TraceChunk* tail;
+
+    explicit ThreadBuffer(int tid) : tid(tid), head(new TraceChunk), tail(head) {}
+
+    ~ThreadBuffer() {
+        while (head) {
+            TraceChunk* next = head->next.load();
+            delete head;
+            head = next;
+        }
+    }
+};
+
+// Buffers outlive their threads so events from finished workers still reach the dump
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::string outputPath;
+    std::atomic<bool> enabled{false};
+};
+
+TraceRegistry& registry() {
+    static TraceRegistry instance;
+    return instance;
+}
+
+const std::chrono::steady_clock::time_point& epoch() {
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return start;
+}
+
+ThreadBuffer* registerThread() {
+    TraceRegistry& traces = registry();
+    std::lock_guard<std::mutex> lock(traces.mutex);
+    traces.buffers.emplace_back(new ThreadBuffer(static_cast<int>(traces.buffers.size()) + 1));
+    return traces.buffers.back().get();
+}
+
+void dumpAtExit() {
+    Tracer::dump();
+}
+
+// Honour RESIZER_TRACE for binaries that don't call Tracer::enable themselves
+struct EnvironmentTrace {
+    EnvironmentTrace() {
+        const char* path = std::getenv("RESIZER_TRACE");
+        if (path && *path) {
+            Tracer::enable(path);
+        }
+    }
+} environmentTrace;
+
+} // namespace
+
+void Tracer::enable(const std::string& outputPath) {
+    TraceRegistry& traces = registry();
+    epoch();
+    {
+        std::lock_guard<std::mutex> lock(traces.mutex);
+        bool first = traces.outputPath.empty();
+        traces.outputPath = outputPath;
+        if (first) {
+            std::atexit(dumpAtExit);
+        }
+    }
+    traces.enabled.store(true, std::memory_order_release);
+}
+
+bool Tracer::enabled() {
+    return registry().enabled.load(std::memory_order_relaxed);
+}
+
+int64_t Tracer::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - epoch()).count();
+}
+
+void Tracer::record(const char* category, const char* name, int64_t beginNs, int64_t endNs) {
+    thread_local ThreadBuffer* buffer = registerThread();
+
+    TraceChunk* chunk = buffer->tail;
+    size_t index = chunk->count.load(std::memory_order_relaxed);
+    if (index == TraceChunk::CAPACITY) {
+        TraceChunk* next = new TraceChunk;
+        chunk->next.store(next, std::memory_order_release);
+        buffer->tail = chunk = next;
+        index = 0;
+    }
+    chunk->events[index] = TraceEvent{category, name, beginNs, endNs};
+    chunk->count.store(index + 1, std::memory_order_release);
+}
+
+void Tracer::dump() {
+    TraceRegistry& traces = registry();
+    std::lock_guard<std::mutex> lock(traces.mutex);
+    if (traces.outputPath.empty()) {
+        return;
+    }
+
+    FILE* out = fopen(traces.outputPath.c_str(), "w");
+    if (!out) {
+        std::cerr << "Could not open trace file: " << traces.outputPath << std::endl;
+        return;
+    }
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", out);
+    bool first = true;
+    for (const auto& buffer : traces.buffers) {
+        fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                first ? "" : ",", buffer->tid, buffer->tid);
+        first = false;
+        for (TraceChunk* chunk = buffer->head; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+            size_t count = chunk->count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; i++) {
+                const TraceEvent& event = chunk->events[i];
+                fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        event.name, event.category, buffer->tid,
+                        event.beginNs / 1000.0, (event.endNs - event.beginNs) / 1000.0);
+            }
+        }
+    }
+    fputs("\n]}\n", out);
+    fclose(out);
+}
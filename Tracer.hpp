@@ -0,0 +1,44 @@
+#ifndef TRACER_HPP
+#define TRACER_HPP
+
+#include <cstdint>
+#include <string>
+
+// Opt-in timeline tracer producing Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+// Enable with Tracer::enable(path) or by setting RESIZER_TRACE=<path>; the trace is written at exit.
+// Each thread appends to its own buffer without locking; the dump reads all of them.
+class Tracer {
+public:
+    static void enable(const std::string& outputPath);
+    static bool enabled();
+
+    // Record a complete event; times are nanoseconds from Tracer::now()
+    static void record(const char* category, const char* name, int64_t beginNs, int64_t endNs);
+    static int64_t now();
+
+    // Write everything recorded so far to the output path
+    static void dump();
+};
+
+// Records a begin/end event for the enclosing scope. Names must be string literals.
+class TraceScope {
+public:
+    TraceScope(const char* category, const char* name)
+        : category(category), name(name), beginNs(Tracer::enabled() ? Tracer::now() : -1) {}
+
+    ~TraceScope() {
+        if (beginNs >= 0) {
+            Tracer::record(category, name, beginNs, Tracer::now());
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* category;
+    const char* name;
+    int64_t beginNs;
+};
+
+#endif // TRACER_HPP
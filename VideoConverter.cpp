@@ -0,0 +1,1078 @@
+#include "VideoConverter.hpp"
+#include "FFmpegResizer.hpp"
+#include "ThreadPool.hpp"
+#include "Tracer.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include <libavutil/opt.h>
+}
+
+static const char* const TRACE_CATEGORY = "VideoConverter";
+
+// Segments shorter than this are merged with the next keyframe interval
+static const int64_t MIN_SEGMENT_MICROSECONDS = 2 * AV_TIME_BASE;
+
+static int readPacket(AVFormatContext* formatContext, AVPacket* packet) {
+    TraceScope trace(TRACE_CATEGORY, "demux");
+    return av_read_frame(formatContext, packet);
+}
+
+namespace {
+
+// Half-open range of source timestamps [start, end) in stream time base
+struct SegmentRange {
+    int64_t start;
+    int64_t end;
+};
+
+struct EncodedSegment {
+    std::vector<AVPacket*> packets;
+
+    ~EncodedSegment() {
+        for (AVPacket*& packet : packets) {
+            av_packet_free(&packet);
+        }
+    }
+};
+
+// One tick per frame when the rate is known. Source time bases such as 1/90000 (TS, MKV)
+// are rejected by the MPEG-4 encoder, which allows at most 65535 ticks per second.
+AVRational encoderTimeBase(AVRational sourceTimeBase, AVRational frameRate) {
+    AVRational timeBase = frameRate.num > 0 && frameRate.den > 0 ? av_inv_q(frameRate) : sourceTimeBase;
+    if (timeBase.num <= 0 || timeBase.den > 65535) {
+        av_reduce(&timeBase.num, &timeBase.den, timeBase.num, timeBase.den, 65535);
+    }
+    if (timeBase.num <= 0) {
+        timeBase = AVRational{1, 65535};
+    }
+    return timeBase;
+}
+
+// A source timestamp in the encoder's time base. Kept strictly increasing, since a one tick
+// per frame base can put two closely spaced variable-rate frames on the same tick.
+int64_t encoderPts(int64_t pts, AVRational sourceTimeBase, AVRational timeBase, int64_t& lastPts) {
+    int64_t rescaled = pts != AV_NOPTS_VALUE ? av_rescale_q(pts, sourceTimeBase, timeBase)
+                     : lastPts != AV_NOPTS_VALUE ? lastPts + 1 : 0;
+    if (lastPts != AV_NOPTS_VALUE && rescaled <= lastPts) {
+        rescaled = lastPts + 1;
+    }
+    lastPts = rescaled;
+    return rescaled;
+}
+
+// Settings shared by every segment encoder so their bitstreams can be concatenated
+struct SegmentEncoderConfig {
+    const AVCodec* codec;
+    int width;
+    int height;
+    AVPixelFormat pixelFormat;
+    AVRational sourceTimeBase;
+    AVRational timeBase;
+    AVRational frameRate;
+    AVRational sampleAspectRatio;
+    bool globalHeader;
+};
+
+AVCodecContext* openSegmentEncoder(const SegmentEncoderConfig& config) {
+    AVCodecContext* encoder = avcodec_alloc_context3(config.codec);
+    if (!encoder) {
+        throw std::runtime_error("Could not allocate encoder context");
+    }
+    encoder->width = config.width;
+    encoder->height = config.height;
+    encoder->pix_fmt = config.pixelFormat;
+    encoder->time_base = config.timeBase;
+    encoder->framerate = config.frameRate;
+    encoder->sample_aspect_ratio = config.sampleAspectRatio;
+    // No B-frames, so dts == pts and timestamps stay monotonic across segment joins
+    encoder->max_b_frames = 0;
+    // Parallelism comes from the segments; a single thread per encoder avoids oversubscription
+    encoder->thread_count = 1;
+    if (config.globalHeader) {
+        encoder->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    if (avcodec_open2(encoder, config.codec, nullptr) < 0) {
+        avcodec_free_context(&encoder);
+        throw std::runtime_error("Could not open video encoder");
+    }
+    return encoder;
+}
+
+// Demux-only pass over the video stream collecting keyframe timestamps
+std::vector<int64_t> scanKeyframes(const std::string& inputPath, int& videoStreamIndex, AVCodecParameters* codecParams,
+                                   AVRational& timeBase, AVRational& frameRate) {
+    AVFormatContext* formatContext = nullptr;
+    if (avformat_open_input(&formatContext, inputPath.c_str(), nullptr, nullptr) < 0) {
+        throw std::runtime_error("Could not open input file");
+    }
+    if (avformat_find_stream_info(formatContext, nullptr) < 0) {
+        avformat_close_input(&formatContext);
+        throw std::runtime_error("Could not find stream information");
+    }
+
+    videoStreamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (videoStreamIndex < 0) {
+        avformat_close_input(&formatContext);
+        throw std::runtime_error("Could not find video stream");
+    }
+    AVStream* stream = formatContext->streams[videoStreamIndex];
+    avcodec_parameters_copy(codecParams, stream->codecpar);
+    timeBase = stream->time_base;
+    frameRate = av_guess_frame_rate(formatContext, stream, nullptr);
+
+    std::vector<int64_t> keyframes;
+    AVPacket* packet = av_packet_alloc();
+    while (packet && readPacket(formatContext, packet) >= 0) {
+        if (packet->stream_index == videoStreamIndex && (packet->flags & AV_PKT_FLAG_KEY)) {
+            int64_t timestamp = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+            if (timestamp != AV_NOPTS_VALUE) {
+                keyframes.push_back(timestamp);
+            }
+        }
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+    avformat_close_input(&formatContext);
+
+    std::sort(keyframes.begin(), keyframes.end());
+    keyframes.erase(std::unique(keyframes.begin(), keyframes.end()), keyframes.end());
+    return keyframes;
+}
+
+// Group keyframe intervals into segments of at least MIN_SEGMENT_MICROSECONDS
+std::vector<SegmentRange> planSegments(const std::vector<int64_t>& keyframes, AVRational timeBase) {
+    const int64_t minDuration = av_rescale_q(MIN_SEGMENT_MICROSECONDS, AV_TIME_BASE_Q, timeBase);
+
+    // The first segment also takes any frames before the first keyframe
+    std::vector<SegmentRange> segments(1, SegmentRange{std::numeric_limits<int64_t>::min(), 0});
+    for (size_t i = 1; i < keyframes.size(); i++) {
+        int64_t segmentStart = segments.size() == 1 ? keyframes[0] : segments.back().start;
+        if (keyframes[i] - segmentStart >= minDuration) {
+            segments.back().end = keyframes[i];
+            segments.push_back(SegmentRange{keyframes[i], 0});
+        }
+    }
+    segments.back().end = std::numeric_limits<int64_t>::max();
+    return segments;
+}
+
+// Open the input and a decoder for the given video stream (-1 picks the best one).
+// On failure the caller frees whatever was already assigned to formatContext/decoder.
+int openVideoDecoder(const std::string& inputPath, int videoStreamIndex, int threads,
+                     AVFormatContext*& formatContext, AVCodecContext*& decoder) {
+    if (avformat_open_input(&formatContext, inputPath.c_str(), nullptr, nullptr) < 0) {
+        throw std::runtime_error("Could not open input file");
+    }
+    if (avformat_find_stream_info(formatContext, nullptr) < 0) {
+        throw std::runtime_error("Could not find stream information");
+    }
+
+    if (videoStreamIndex < 0) {
+        videoStreamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+        if (videoStreamIndex < 0) {
+            throw std::runtime_error("Could not find video stream");
+        }
+    }
+
+    AVCodecParameters* codecParams = formatContext->streams[videoStreamIndex]->codecpar;
+    const AVCodec* codec = avcodec_find_decoder(codecParams->codec_id);
+    if (!codec) {
+        throw std::runtime_error("Unsupported codec");
+    }
+    decoder = avcodec_alloc_context3(codec);
+    if (!decoder || avcodec_parameters_to_context(decoder, codecParams) < 0) {
+        throw std::runtime_error("Failed to prepare decoder");
+    }
+    decoder->thread_count = threads;
+    accountDecoderBuffers(decoder);
+    if (avcodec_open2(decoder, codec, nullptr) < 0) {
+        throw std::runtime_error("Failed to open codec");
+    }
+    return videoStreamIndex;
+}
+
+// Decode [range.start, range.end) with a private demuxer/decoder and encode it with a private encoder
+void transcodeSegment(const std::string& inputPath, int videoStreamIndex, const SegmentRange& range,
+                      const SegmentEncoderConfig& config, EncodedSegment& result) {
+    AVFormatContext* formatContext = nullptr;
+    AVCodecContext* decoder = nullptr;
+    AVCodecContext* encoder = nullptr;
+    SwsContext* swsContext = nullptr;
+    AVFrame* frame = nullptr;
+    AVPacket* packet = nullptr;
+
+    try {
+        openVideoDecoder(inputPath, videoStreamIndex, 1, formatContext, decoder);
+        encoder = openSegmentEncoder(config);
+        frame = av_frame_alloc();
+        packet = av_packet_alloc();
+        if (!frame || !packet) {
+            throw std::runtime_error("Failed to allocate frame or packet");
+        }
+
+        if (range.start != std::numeric_limits<int64_t>::min() &&
+            av_seek_frame(formatContext, videoStreamIndex, range.start, AVSEEK_FLAG_BACKWARD) < 0) {
+            throw std::runtime_error("Could not seek to segment start");
+        }
+
+        auto receivePackets = [&](const AVFrame* converted) {
+            TraceScope trace(TRACE_CATEGORY, "encode");
+            if (avcodec_send_frame(encoder, converted) < 0) {
+                throw std::runtime_error("Error sending frame to encoder");
+            }
+            AVPacket* encoded = av_packet_alloc();
+            while (encoded && avcodec_receive_packet(encoder, encoded) >= 0) {
+                // Segments wait in memory until their turn to be muxed
+                accountPacketBuffer(encoded);
+                result.packets.push_back(encoded);
+                encoded = av_packet_alloc();
+            }
+            av_packet_free(&encoded);
+        };
+
+        // Frames leave the decoder in presentation order, so the first one at or past
+        // range.end means the segment is complete
+        bool reachedEnd = false;
+        int64_t lastPts = AV_NOPTS_VALUE;
+        // A frame without a timestamp is placed one frame after the previous one
+        int64_t previousPts = AV_NOPTS_VALUE;
+        const int64_t frameDuration = config.frameRate.num > 0 && config.frameRate.den > 0
+            ? std::max<int64_t>(1, av_rescale_q(1, av_inv_q(config.frameRate), config.sourceTimeBase))
+            : 1;
+        auto drainDecoder = [&]() {
+            while (!reachedEnd) {
+                {
+                    TraceScope trace(TRACE_CATEGORY, "decode");
+                    if (avcodec_receive_frame(decoder, frame) < 0) {
+                        return;
+                    }
+                }
+                memoryCheck();
+                int64_t pts = frame->best_effort_timestamp;
+                if (pts == AV_NOPTS_VALUE && previousPts != AV_NOPTS_VALUE) {
+                    pts = previousPts + frameDuration;
+                }
+                previousPts = pts;
+                if (pts >= range.end) {
+                    reachedEnd = true;
+                } else if (pts >= range.start) {
+                    AVFrame* converted = av_frame_alloc();
+                    if (!converted) {
+                        throw std::runtime_error("Failed to allocate frame");
+                    }
+                    converted->format = config.pixelFormat;
+                    converted->width = config.width;
+                    converted->height = config.height;
+                    if (av_frame_get_buffer(converted, 0) < 0) {
+                        av_frame_free(&converted);
+                        throw std::runtime_error("Failed to allocate frame buffer");
+                    }
+                    accountFrameBuffers(converted);
+
+                    swsContext = sws_getCachedContext(swsContext,
+                        frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+                        config.width, config.height, config.pixelFormat,
+                        SWS_BILINEAR, nullptr, nullptr, nullptr
+                    );
+                    if (!swsContext) {
+                        av_frame_free(&converted);
+                        throw std::runtime_error("Could not initialize scaling context");
+                    }
+                    {
+                        TraceScope trace(TRACE_CATEGORY, "colorspace");
+                        sws_scale(swsContext, frame->data, frame->linesize, 0, frame->height,
+                                  converted->data, converted->linesize);
+                    }
+                    converted->pts = encoderPts(pts, config.sourceTimeBase, config.timeBase, lastPts);
+
+                    try {
+                        receivePackets(converted);
+                    } catch (...) {
+                        av_frame_free(&converted);
+                        throw;
+                    }
+                    av_frame_free(&converted);
+                }
+                av_frame_unref(frame);
+            }
+        };
+
+        while (!reachedEnd && readPacket(formatContext, packet) >= 0) {
+            if (packet->stream_index == videoStreamIndex) {
+                TraceScope trace(TRACE_CATEGORY, "decode");
+                avcodec_send_packet(decoder, packet);
+            }
+            av_packet_unref(packet);
+            drainDecoder();
+        }
+        if (!reachedEnd) {
+            avcodec_send_packet(decoder, nullptr);
+            drainDecoder();
+        }
+        receivePackets(nullptr);
+    } catch (...) {
+        sws_freeContext(swsContext);
+        av_frame_free(&frame);
+        av_packet_free(&packet);
+        avcodec_free_context(&encoder);
+        avcodec_free_context(&decoder);
+        avformat_close_input(&formatContext);
+        throw;
+    }
+
+    sws_freeContext(swsContext);
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&encoder);
+    avcodec_free_context(&decoder);
+    avformat_close_input(&formatContext);
+}
+
+// Bounded hand-off between the ladder decoder and one rendition branch
+class FrameQueue {
+public:
+    explicit FrameQueue(size_t capacity) : capacity(capacity) {}
+
+    ~FrameQueue() {
+        for (AVFrame*& frame : frames) {
+            av_frame_free(&frame);
+        }
+    }
+
+    // Blocks while the queue is full; frees the frame and returns false once the consumer has stopped
+    bool push(AVFrame* frame) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return closed || frames.size() < capacity; });
+        if (closed) {
+            av_frame_free(&frame);
+            return false;
+        }
+        frames.push_back(frame);
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // Blocks until a frame is available; nullptr once the producer has finished
+    AVFrame* pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return finished || !frames.empty(); });
+        if (frames.empty()) {
+            return nullptr;
+        }
+        AVFrame* frame = frames.front();
+        frames.pop_front();
+        notFull.notify_one();
+        return frame;
+    }
+
+    // Producer side: no more frames will be pushed
+    void finish() {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        notEmpty.notify_all();
+    }
+
+    // Consumer side: stop accepting frames (e.g. after an encoder error)
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notFull.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::deque<AVFrame*> frames;
+    size_t capacity;
+    bool finished = false;
+    bool closed = false;
+};
+
+// One rung of the ladder: scaler, encoder and MP4 muxer fed from a shared decoder
+struct LadderBranch {
+    int width = 0;
+    int height = 0;
+    int64_t bitrate = 0;
+    AVFormatContext* formatContext = nullptr;
+    AVCodecContext* encoder = nullptr;
+    AVStream* stream = nullptr;
+    SwsContext* swsContext = nullptr;
+    AVPacket* packet = nullptr;
+    FrameQueue queue{8};
+
+    ~LadderBranch() {
+        sws_freeContext(swsContext);
+        av_packet_free(&packet);
+        avcodec_free_context(&encoder);
+        if (formatContext) {
+            if (formatContext->pb) {
+                avio_closep(&formatContext->pb);
+            }
+            avformat_free_context(formatContext);
+        }
+    }
+
+    void open(const std::string& outputPath, const AVCodec* codec, AVRational timeBase,
+              AVRational frameRate, int gopSize) {
+        avformat_alloc_output_context2(&formatContext, nullptr, "mp4", outputPath.c_str());
+        if (!formatContext) {
+            throw std::runtime_error("Could not create output context");
+        }
+
+        encoder = avcodec_alloc_context3(codec);
+        if (!encoder) {
+            throw std::runtime_error("Could not allocate encoder context");
+        }
+        encoder->width = width;
+        encoder->height = height;
+        encoder->pix_fmt = codec->pix_fmts ? codec->pix_fmts[0] : AV_PIX_FMT_YUV420P;
+        encoder->time_base = timeBase;
+        encoder->framerate = frameRate;
+        // The branch width already carries the source's display aspect
+        encoder->sample_aspect_ratio = AVRational{1, 1};
+        // Fixed GOP with keyframes forced on the same source frames in every rendition,
+        // so players can switch renditions at any keyframe
+        encoder->gop_size = gopSize;
+        encoder->keyint_min = gopSize;
+        // Capped rate with a two-second buffer, so a player can pick renditions by bandwidth
+        if (bitrate > 0) {
+            encoder->bit_rate = bitrate;
+            encoder->rc_max_rate = bitrate;
+            encoder->rc_buffer_size = static_cast<int>(std::min<int64_t>(2 * bitrate, INT32_MAX));
+        }
+        // Scene-cut keyframes would land on different frames in each rendition. libx264 takes
+        // scenecut=0; the MPEG-4 fallback needs a threshold no frame difference reaches.
+        if (av_opt_set(encoder->priv_data, "x264-params", "scenecut=0", 0) >= 0) {
+            if (av_opt_set(encoder->priv_data, "forced-idr", "1", 0) < 0) {
+                throw std::runtime_error("Could not force IDR keyframes");
+            }
+        } else if (av_opt_set(encoder, "sc_threshold", "1000000000", AV_OPT_SEARCH_CHILDREN) < 0) {
+            throw std::runtime_error("Could not disable scene-cut keyframes");
+        }
+        if (formatContext->oformat->flags & AVFMT_GLOBALHEADER) {
+            encoder->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        }
+        if (avcodec_open2(encoder, codec, nullptr) < 0) {
+            throw std::runtime_error("Could not open video encoder");
+        }
+
+        stream = avformat_new_stream(formatContext, nullptr);
+        if (!stream || avcodec_parameters_from_context(stream->codecpar, encoder) < 0) {
+            throw std::runtime_error("Could not allocate stream");
+        }
+        stream->time_base = timeBase;
+
+        if (avio_open(&formatContext->pb, outputPath.c_str(), AVIO_FLAG_WRITE) < 0) {
+            throw std::runtime_error("Could not open output file: " + outputPath);
+        }
+        if (avformat_write_header(formatContext, nullptr) < 0) {
+            throw std::runtime_error("Could not write output header");
+        }
+
+        packet = av_packet_alloc();
+        if (!packet) {
+            throw std::runtime_error("Could not allocate packet");
+        }
+    }
+
+    void encode(const AVFrame* scaled) {
+        TraceScope trace(TRACE_CATEGORY, "encode");
+        if (avcodec_send_frame(encoder, scaled) < 0) {
+            throw std::runtime_error("Error sending frame to encoder");
+        }
+        while (avcodec_receive_packet(encoder, packet) >= 0) {
+            av_packet_rescale_ts(packet, encoder->time_base, stream->time_base);
+            packet->stream_index = stream->index;
+            TraceScope writeTrace(TRACE_CATEGORY, "write");
+            if (av_interleaved_write_frame(formatContext, packet) < 0) {
+                throw std::runtime_error("Error writing output packet");
+            }
+        }
+    }
+
+    // Worker loop: scale and encode every queued frame, then flush and finalize the file
+    void run() {
+        try {
+            while (AVFrame* source = queue.pop()) {
+                AVFrame* scaled = av_frame_alloc();
+                try {
+                    if (!scaled) {
+                        throw std::runtime_error("Failed to allocate frame");
+                    }
+                    scaled->format = encoder->pix_fmt;
+                    scaled->width = width;
+                    scaled->height = height;
+                    if (av_frame_get_buffer(scaled, 0) < 0) {
+                        throw std::runtime_error("Failed to allocate frame buffer");
+                    }
+                    accountFrameBuffers(scaled);
+
+                    swsContext = sws_getCachedContext(swsContext,
+                        source->width, source->height, static_cast<AVPixelFormat>(source->format),
+                        width, height, encoder->pix_fmt,
+                        SWS_BILINEAR, nullptr, nullptr, nullptr
+                    );
+                    if (!swsContext) {
+                        throw std::runtime_error("Could not initialize scaling context");
+                    }
+                    {
+                        TraceScope trace(TRACE_CATEGORY, "scale");
+                        sws_scale(swsContext, source->data, source->linesize, 0, source->height,
+                                  scaled->data, scaled->linesize);
+                    }
+                    scaled->pts = source->pts;
+                    scaled->pict_type = source->pict_type;
+                    encode(scaled);
+                } catch (...) {
+                    av_frame_free(&scaled);
+                    av_frame_free(&source);
+                    throw;
+                }
+                av_frame_free(&scaled);
+                av_frame_free(&source);
+            }
+
+            encode(nullptr);
+            if (av_write_trailer(formatContext) < 0) {
+                throw std::runtime_error("Could not write output trailer");
+            }
+        } catch (...) {
+            // Unblock the decoder so it notices the failure instead of waiting on a full queue
+            queue.close();
+            throw;
+        }
+    }
+};
+
+} // namespace
+
+void VideoConverter::setJpegBackend(JpegBackend backend) {
+    jpegCodec = createJpegCodec(backend);
+    jpegBackend = backend;
+}
+
+void VideoConverter::setJpegOptions(const JpegOptions& options) {
+    jpegOptions = options;
+}
+
+void VideoConverter::setMemoryLimit(int64_t bytes) {
+    memoryLimit = bytes;
+}
+
+const JobStats& VideoConverter::lastJobStats() const {
+    return lastStats;
+}
+
+void VideoConverter::convertToMP4(const std::string& inputPath, const std::string& outputPath) {
+    JobScope job(lastStats, memoryLimit);
+    AVFormatContext* inputFormatContext = nullptr;
+    AVFormatContext* outputFormatContext = nullptr;
+
+    // Open input file
+    if (avformat_open_input(&inputFormatContext, inputPath.c_str(), nullptr, nullptr) < 0) {
+        throw std::runtime_error("Could not open input file");
+    }
+
+    // Create output format context
+    avformat_alloc_output_context2(&outputFormatContext, nullptr, "mp4", outputPath.c_str());
+    if (!outputFormatContext) {
+        avformat_close_input(&inputFormatContext);
+        throw std::runtime_error("Could not create output context");
+    }
+
+    // Find video stream and add it to output context
+    for (unsigned int i = 0; i < inputFormatContext->nb_streams; i++) {
+        if (inputFormatContext->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            AVStream* outStream = avformat_new_stream(outputFormatContext, nullptr);
+            if (!outStream) {
+                avformat_close_input(&inputFormatContext);
+                avformat_free_context(outputFormatContext);
+                throw std::runtime_error("Could not allocate stream");
+            }
+            
+            // Copy codec parameters from input to output
+            avcodec_parameters_copy(outStream->codecpar, inputFormatContext->streams[i]->codecpar);
+            outStream->codecpar->codec_tag = 0; // Set codec tag to zero for MP4
+        }
+    }
+
+    // Open output file
+    if (avio_open(&outputFormatContext->pb, outputPath.c_str(), AVIO_FLAG_WRITE) < 0) {
+        avformat_close_input(&inputFormatContext);
+        avformat_free_context(outputFormatContext);
+        throw std::runtime_error("Could not open output file");
+    }
+
+    // Write the output file header
+    if (avformat_write_header(outputFormatContext, nullptr) < 0) {
+        avformat_close_input(&inputFormatContext);
+        avio_closep(&outputFormatContext->pb);
+        avformat_free_context(outputFormatContext);
+        throw std::runtime_error("Could not write output header");
+    }
+
+    // Read packets from input and write them to output
+    AVPacket packet;
+    while (readPacket(inputFormatContext, &packet) >= 0) {
+        TraceScope trace(TRACE_CATEGORY, "write");
+        av_interleaved_write_frame(outputFormatContext, &packet);
+        av_packet_unref(&packet);
+    }
+
+    // Write the trailer
+    av_write_trailer(outputFormatContext);
+    avformat_close_input(&inputFormatContext);
+    avio_closep(&outputFormatContext->pb);
+    avformat_free_context(outputFormatContext);
+}
+
+void VideoConverter::extractThumbnail(const std::string& inputPath, const std::string& thumbnailPath) {
+    JobScope job(lastStats, memoryLimit);
+    AVFormatContext* formatContext = nullptr;
+    AVCodecContext* codecContext = nullptr;
+    AVFrame* frame = nullptr;
+    AVPacket* packet = nullptr;
+    SwsContext* swsContext = nullptr;
+
+    try {
+        // Open the input file
+        if (avformat_open_input(&formatContext, inputPath.c_str(), nullptr, nullptr) < 0) {
+            throw std::runtime_error("Could not open input file");
+        }
+
+        // Retrieve stream information
+        if (avformat_find_stream_info(formatContext, nullptr) < 0) {
+            throw std::runtime_error("Could not find stream information");
+        }
+
+        // Find the first video stream
+        int videoStreamIndex = -1;
+        for (unsigned int i = 0; i < formatContext->nb_streams; i++) {
+            if (formatContext->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+                videoStreamIndex = i;
+                break;
+            }
+        }
+
+        if (videoStreamIndex == -1) {
+            throw std::runtime_error("Could not find video stream");
+        }
+
+        // Get a pointer to the codec context for the video stream
+        const AVCodec* codec = avcodec_find_decoder(formatContext->streams[videoStreamIndex]->codecpar->codec_id);
+        if (!codec) {
+            throw std::runtime_error("Unsupported codec");
+        }
+
+        codecContext = avcodec_alloc_context3(codec);
+        if (!codecContext) {
+            throw std::runtime_error("Failed to allocate codec context");
+        }
+
+        if (avcodec_parameters_to_context(codecContext, formatContext->streams[videoStreamIndex]->codecpar) < 0) {
+            throw std::runtime_error("Failed to copy codec parameters to codec context");
+        }
+        accountDecoderBuffers(codecContext);
+
+        if (avcodec_open2(codecContext, codec, nullptr) < 0) {
+            throw std::runtime_error("Failed to open codec");
+        }
+
+        frame = av_frame_alloc();
+        packet = av_packet_alloc();
+
+        if (!frame || !packet) {
+            throw std::runtime_error("Failed to allocate frame or packet");
+        }
+
+        // Seek to 10% of the video duration
+        int64_t duration = formatContext->duration;
+        int64_t seekTarget = duration / 10;
+        av_seek_frame(formatContext, -1, seekTarget, AVSEEK_FLAG_BACKWARD);
+
+        // Read frames until we get a video frame
+        while (readPacket(formatContext, packet) >= 0) {
+            if (packet->stream_index == videoStreamIndex) {
+                int response;
+                {
+                    TraceScope trace(TRACE_CATEGORY, "decode");
+                    response = avcodec_send_packet(codecContext, packet);
+                    if (response >= 0) {
+                        response = avcodec_receive_frame(codecContext, frame);
+                    } else {
+                        response = AVERROR(EAGAIN);
+                    }
+                }
+                if (response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
+                    av_packet_unref(packet);
+                    continue;
+                } else if (response < 0) {
+                    throw std::runtime_error("Error while decoding");
+                }
+
+                swsContext = sws_getContext(
+                    codecContext->width, codecContext->height, codecContext->pix_fmt,
+                    codecContext->width, codecContext->height, AV_PIX_FMT_RGB24,
+                    SWS_BILINEAR, nullptr, nullptr, nullptr
+                );
+
+                if (!swsContext) {
+                    throw std::runtime_error("Could not initialize scaling context");
+                }
+
+                // Allocate RGB frame
+                AVFrame* rgbFrame = av_frame_alloc();
+                rgbFrame->format = AV_PIX_FMT_RGB24;
+                rgbFrame->width = codecContext->width;
+                rgbFrame->height = codecContext->height;
+                av_frame_get_buffer(rgbFrame, 0);
+                accountFrameBuffers(rgbFrame);
+
+                // Convert frame to RGB
+                {
+                    TraceScope trace(TRACE_CATEGORY, "colorspace");
+                    sws_scale(swsContext, frame->data, frame->linesize, 0, codecContext->height,
+                              rgbFrame->data, rgbFrame->linesize);
+                }
+
+                // Save the RGB frame as JPEG
+                saveFrameAsJPEG(rgbFrame, thumbnailPath);
+
+                // Cleanup
+                av_frame_free(&rgbFrame);
+                sws_freeContext(swsContext);
+
+                // Use FFmpegResizer to create different sizes
+                // The thumbnail is decoded once and cached for all presets, largest first
+                FFmpegResizer resizer;
+                resizer.setJpegBackend(jpegBackend);
+                resizer.setJpegOptions(jpegOptions);
+                resizer.setFrameCache(std::make_shared<FrameCache>(
+                    static_cast<int64_t>(codecContext->width) * codecContext->height * 4));
+                for (int i = PRESET_COUNT - 1; i >= 0; i--) {
+                    const PresetSpec& preset = PRESETS[i];
+                    resizer.resizeWithPreset(thumbnailPath, thumbnailPath + "_" + preset.name + ".jpg", preset.size);
+                }
+
+                break;
+            }
+            av_packet_unref(packet);
+        }
+
+    } catch (const std::exception& e) {
+        // Cleanup
+        if (codecContext) avcodec_free_context(&codecContext);
+        if (formatContext) avformat_close_input(&formatContext);
+        if (frame) av_frame_free(&frame);
+        if (packet) av_packet_free(&packet);
+        throw;
+    }
+
+    // Cleanup
+    if (codecContext) avcodec_free_context(&codecContext);
+    if (formatContext) avformat_close_input(&formatContext);
+    if (frame) av_frame_free(&frame);
+    if (packet) av_packet_free(&packet);
+}
+
+void VideoConverter::saveFrameAsJPEG(AVFrame* frame, const std::string& filename) {
+    std::vector<uint8_t> jpeg;
+    jpegCodec->encode(frame->data[0], frame->linesize[0], frame->width, frame->height, jpegOptions, jpeg);
+
+    FILE* f = fopen(filename.c_str(), "wb");
+    if (!f) {
+        throw std::runtime_error("Could not open output file");
+    }
+
+    TraceScope trace(TRACE_CATEGORY, "write");
+    fwrite(jpeg.data(), 1, jpeg.size(), f);
+    fclose(f);
+}
+
+void VideoConverter::convertToMP4Segmented(const std::string& inputPath, const std::string& outputPath, unsigned threads) {
+    JobScope job(lastStats, memoryLimit);
+    int videoStreamIndex = -1;
+    AVRational timeBase;
+    AVRational frameRate;
+    AVCodecParameters* codecParams = avcodec_parameters_alloc();
+    if (!codecParams) {
+        throw std::runtime_error("Could not allocate codec parameters");
+    }
+
+    std::vector<SegmentRange> segments;
+    try {
+        segments = planSegments(scanKeyframes(inputPath, videoStreamIndex, codecParams, timeBase, frameRate), timeBase);
+    } catch (...) {
+        avcodec_parameters_free(&codecParams);
+        throw;
+    }
+
+    SegmentEncoderConfig config;
+    config.codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+    if (!config.codec) {
+        config.codec = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+    }
+    config.width = codecParams->width;
+    config.height = codecParams->height;
+    config.pixelFormat = config.codec && config.codec->pix_fmts ? config.codec->pix_fmts[0] : AV_PIX_FMT_YUV420P;
+    config.sourceTimeBase = timeBase;
+    config.timeBase = encoderTimeBase(timeBase, frameRate);
+    config.frameRate = frameRate;
+    config.sampleAspectRatio = codecParams->sample_aspect_ratio;
+    avcodec_parameters_free(&codecParams);
+    if (!config.codec) {
+        throw std::runtime_error("Could not find an H.264 or MPEG-4 encoder");
+    }
+
+    AVFormatContext* outputFormatContext = nullptr;
+    avformat_alloc_output_context2(&outputFormatContext, nullptr, "mp4", outputPath.c_str());
+    if (!outputFormatContext) {
+        throw std::runtime_error("Could not create output context");
+    }
+    config.globalHeader = (outputFormatContext->oformat->flags & AVFMT_GLOBALHEADER) != 0;
+
+    try {
+        // Every segment encoder uses identical settings, so a template encoder
+        // provides the stream parameters (and SPS/PPS extradata) for all of them
+        AVCodecContext* templateEncoder = openSegmentEncoder(config);
+        AVStream* outStream = avformat_new_stream(outputFormatContext, nullptr);
+        if (!outStream || avcodec_parameters_from_context(outStream->codecpar, templateEncoder) < 0) {
+            avcodec_free_context(&templateEncoder);
+            throw std::runtime_error("Could not allocate stream");
+        }
+        outStream->time_base = config.timeBase;
+        avcodec_free_context(&templateEncoder);
+
+        if (avio_open(&outputFormatContext->pb, outputPath.c_str(), AVIO_FLAG_WRITE) < 0) {
+            throw std::runtime_error("Could not open output file");
+        }
+        if (avformat_write_header(outputFormatContext, nullptr) < 0) {
+            throw std::runtime_error("Could not write output header");
+        }
+
+        // Segments are handed out in order and muxed in order; only a bounded window
+        // of encoded segments is held in memory at once
+        std::vector<std::unique_ptr<EncodedSegment>> results(segments.size());
+        std::deque<std::future<void>> pending;
+        // Each segment keeps its timestamps strictly increasing on its own, which can carry its
+        // last frame up to the next segment's first; later packets are shifted past the join
+        int64_t lastDts = AV_NOPTS_VALUE;
+        {
+            ThreadPool pool(threads);
+            const size_t window = 2 * pool.size();
+            size_t nextToSubmit = 0;
+
+            auto submitNext = [&]() {
+                size_t index = nextToSubmit++;
+                results[index].reset(new EncodedSegment);
+                EncodedSegment* result = results[index].get();
+                const SegmentRange range = segments[index];
+                std::shared_ptr<MemoryAccount> account = MemoryScope::current();
+                pending.push_back(pool.submit([&inputPath, videoStreamIndex, range, &config, result, account] {
+                    MemoryScope memoryScope(account);
+                    transcodeSegment(inputPath, videoStreamIndex, range, config, *result);
+                }));
+            };
+
+            while (nextToSubmit < segments.size() && nextToSubmit < window) {
+                submitNext();
+            }
+
+            for (size_t index = 0; index < segments.size(); index++) {
+                pending.front().get();
+                pending.pop_front();
+                if (nextToSubmit < segments.size()) {
+                    submitNext();
+                }
+
+                TraceScope trace(TRACE_CATEGORY, "write");
+                int64_t shift = 0;
+                for (AVPacket* packet : results[index]->packets) {
+                    if (lastDts != AV_NOPTS_VALUE && packet->dts != AV_NOPTS_VALUE && packet->dts + shift <= lastDts) {
+                        shift = lastDts + 1 - packet->dts;
+                    }
+                    if (packet->dts != AV_NOPTS_VALUE) {
+                        packet->dts += shift;
+                        lastDts = packet->dts;
+                    }
+                    if (packet->pts != AV_NOPTS_VALUE) {
+                        packet->pts += shift;
+                    }
+                    av_packet_rescale_ts(packet, config.timeBase, outStream->time_base);
+                    packet->stream_index = outStream->index;
+                    if (av_interleaved_write_frame(outputFormatContext, packet) < 0) {
+                        throw std::runtime_error("Error writing output packet");
+                    }
+                }
+                results[index].reset();
+            }
+        }
+
+        av_write_trailer(outputFormatContext);
+    } catch (...) {
+        if (outputFormatContext->pb) {
+            avio_closep(&outputFormatContext->pb);
+        }
+        avformat_free_context(outputFormatContext);
+        throw;
+    }
+
+    avio_closep(&outputFormatContext->pb);
+    avformat_free_context(outputFormatContext);
+}
+
+std::vector<Rendition> VideoConverter::convertToLadder(const std::string& inputPath, const std::vector<Rendition>& renditions) {
+    JobScope job(lastStats, memoryLimit);
+    AVFormatContext* formatContext = nullptr;
+    AVCodecContext* decoder = nullptr;
+    AVFrame* frame = nullptr;
+    AVPacket* packet = nullptr;
+    std::vector<Rendition> produced;
+
+    try {
+        // One decoder for the whole ladder, using all cores
+        int videoStreamIndex = openVideoDecoder(inputPath, -1, 0, formatContext, decoder);
+        AVStream* inStream = formatContext->streams[videoStreamIndex];
+        AVRational frameRate = av_guess_frame_rate(formatContext, inStream, nullptr);
+        int gopSize = frameRate.num > 0 && frameRate.den > 0
+                    ? std::max(1, static_cast<int>(2 * av_q2d(frameRate) + 0.5))
+                    : 48;
+        // Every branch shares one encoder time base, so frames are retimed once before fan-out
+        AVRational timeBase = encoderTimeBase(inStream->time_base, frameRate);
+        int64_t lastPts = AV_NOPTS_VALUE;
+
+        const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+        if (!codec) {
+            codec = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+        }
+        if (!codec) {
+            throw std::runtime_error("Could not find an H.264 or MPEG-4 encoder");
+        }
+
+        // Renditions have square pixels, so anamorphic sources are widened to their display aspect
+        AVRational sampleAspect = decoder->sample_aspect_ratio;
+        if (sampleAspect.num <= 0 || sampleAspect.den <= 0) {
+            sampleAspect = AVRational{1, 1};
+        }
+
+        // Renditions taller than the source would only upscale, so they are skipped
+        std::vector<std::unique_ptr<LadderBranch>> branches;
+        for (const Rendition& rendition : renditions) {
+            if (rendition.height > decoder->height) {
+                continue;
+            }
+            std::unique_ptr<LadderBranch> branch(new LadderBranch);
+            branch->height = rendition.height & ~1;
+            branch->width = static_cast<int>(av_rescale(static_cast<int64_t>(decoder->width) * sampleAspect.num,
+                                                        branch->height,
+                                                        static_cast<int64_t>(decoder->height) * sampleAspect.den)) & ~1;
+            branch->bitrate = rendition.bitrate;
+            branch->open(rendition.outputPath, codec, timeBase, frameRate, gopSize);
+            branches.push_back(std::move(branch));
+            produced.push_back(rendition);
+        }
+        if (branches.empty()) {
+            throw std::runtime_error("No rendition fits the source resolution");
+        }
+
+        frame = av_frame_alloc();
+        packet = av_packet_alloc();
+        if (!frame || !packet) {
+            throw std::runtime_error("Failed to allocate frame or packet");
+        }
+
+        {
+            ThreadPool pool(static_cast<unsigned>(branches.size()));
+            std::vector<std::future<void>> results;
+            std::shared_ptr<MemoryAccount> account = MemoryScope::current();
+            for (auto& branch : branches) {
+                LadderBranch* target = branch.get();
+                results.push_back(pool.submit([target, account] {
+                    MemoryScope memoryScope(account);
+                    target->run();
+                }));
+            }
+
+            // Each decoded frame is shared with every branch by reference; no pixels are copied
+            int64_t frameIndex = 0;
+            bool branchFailed = false;
+            auto distribute = [&](const AVPacket* pkt) {
+                {
+                    TraceScope trace(TRACE_CATEGORY, "decode");
+                    if (avcodec_send_packet(decoder, pkt) < 0) {
+                        return;
+                    }
+                }
+                for (;;) {
+                    {
+                        TraceScope trace(TRACE_CATEGORY, "decode");
+                        if (avcodec_receive_frame(decoder, frame) < 0) {
+                            return;
+                        }
+                    }
+                    memoryCheck();
+                    frame->pts = encoderPts(frame->best_effort_timestamp, inStream->time_base, timeBase, lastPts);
+                    frame->pict_type = frameIndex++ % gopSize == 0 ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+                    for (auto& branch : branches) {
+                        AVFrame* shared = av_frame_clone(frame);
+                        if (!shared) {
+                            throw std::runtime_error("Could not reference decoded frame");
+                        }
+                        branchFailed = !branch->queue.push(shared) || branchFailed;
+                    }
+                    av_frame_unref(frame);
+                    if (branchFailed) {
+                        return;
+                    }
+                }
+            };
+
+            try {
+                while (!branchFailed && readPacket(formatContext, packet) >= 0) {
+                    if (packet->stream_index == videoStreamIndex) {
+                        distribute(packet);
+                    }
+                    av_packet_unref(packet);
+                }
+                if (!branchFailed) {
+                    distribute(nullptr);
+                }
+            } catch (...) {
+                for (auto& branch : branches) {
+                    branch->queue.finish();
+                }
+                throw;
+            }
+
+            for (auto& branch : branches) {
+                branch->queue.finish();
+            }
+            for (auto& result : results) {
+                result.get();
+            }
+        }
+    } catch (...) {
+        av_packet_free(&packet);
+        av_frame_free(&frame);
+        avcodec_free_context(&decoder);
+        avformat_close_input(&formatContext);
+        throw;
+    }
+
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    avcodec_free_context(&decoder);
+    avformat_close_input(&formatContext);
+    return produced;
+}
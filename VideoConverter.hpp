@@ -0,0 +1,74 @@
+#ifndef VIDEO_CONVERTER_HPP
+#define VIDEO_CONVERTER_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "JobStats.hpp"
+#include "JpegCodec.hpp"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+#include <libavutil/imgutils.h>
+}
+
+// One output of an adaptive-bitrate ladder; width follows the source aspect ratio.
+// bitrate (bits/s) is also the rendition's peak rate; 0 leaves rate control to the encoder.
+struct Rendition {
+    int height;
+    int64_t bitrate;
+    std::string outputPath;
+};
+
+// Default ladder rungs
+struct LadderRung {
+    int height;
+    int64_t bitrate;
+};
+
+constexpr LadderRung LADDER_RUNGS[] = {
+    {1080, 5000000},
+    {720, 2800000},
+    {480, 1400000},
+    {240, 400000},
+};
+
+class VideoConverter {
+public:
+    void convertToMP4(const std::string& inputPath, const std::string& outputPath);
+    void extractThumbnail(const std::string& inputPath, const std::string& thumbnailPath);
+
+    // Re-encode the video stream to H.264 by splitting it at keyframes and transcoding the
+    // segments on independent threads (0 = one per hardware thread), then muxing them in order
+    void convertToMP4Segmented(const std::string& inputPath, const std::string& outputPath, unsigned threads = 0);
+
+    // Decode once and encode every rendition in parallel, each to its own MP4 with keyframes on
+    // the same source frames. Returns the renditions written (taller-than-source ones are skipped).
+    std::vector<Rendition> convertToLadder(const std::string& inputPath, const std::vector<Rendition>& renditions);
+
+    // Codec for the extracted thumbnail and its resized versions
+    void setJpegBackend(JpegBackend backend);
+    void setJpegOptions(const JpegOptions& options);
+
+    // Cap on the memory one conversion may account for (0 = no cap); a job over the cap throws
+    void setMemoryLimit(int64_t bytes);
+    // Wall time and memory use of the most recent conversion or thumbnail extraction
+    const JobStats& lastJobStats() const;
+
+private:
+    JpegBackend jpegBackend = JpegBackend::LIBAV;
+    JpegOptions jpegOptions;
+    std::unique_ptr<JpegCodec> jpegCodec = createJpegCodec(JpegBackend::LIBAV);
+    int64_t memoryLimit = 0;
+    JobStats lastStats;
+
+    void saveFrameAsJPEG(AVFrame* frame, const std::string& filename);
+};
+
+#endif // VIDEO_CONVERTER_HPP
@@ -0,0 +1,292 @@
+#include "WatchFolder.hpp"
+#include "ThreadPool.hpp"
+#include "Tracer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+namespace {
+
+const char* TRACE_CATEGORY = "WatchFolder";
+
+typedef std::chrono::steady_clock Clock;
+
+// Bytes written to the wake pipe
+const char STOP_BYTE = 's';
+const char RETRY_BYTE = 'r';
+
+// Dotfiles are the usual temporary names for in-progress uploads (rsync, scp -p, browsers)
+bool ignoredName(const std::string& name) {
+    return name.empty() || name[0] == '.';
+}
+
+bool sameDirectory(const std::string& a, const std::string& b) {
+    struct stat infoA, infoB;
+    return stat(a.c_str(), &infoA) == 0 && stat(b.c_str(), &infoB) == 0 &&
+           infoA.st_dev == infoB.st_dev && infoA.st_ino == infoB.st_ino;
+}
+
+} // namespace
+
+bool WatchFolder::FileKey::operator<(const FileKey& other) const {
+    if (name != other.name) {
+        return name < other.name;
+    }
+    return file < other.file;
+}
+
+WatchFolder::WatchFolder(const std::string& inputDir, const std::string& outputDir,
+                         const std::string& journalPath, unsigned threads)
+    : inputDir(inputDir), outputDir(outputDir),
+      journalPath(journalPath.empty() ? outputDir + "/.resize_journal" : journalPath),
+      threadCount(threads) {
+#ifndef __linux__
+    throw std::runtime_error("Watch mode needs inotify and is only available on Linux");
+#else
+    // Every output would raise its own event and be resized again, without end
+    if (sameDirectory(inputDir, outputDir)) {
+        throw std::runtime_error("Output directory must differ from the watched directory: " + outputDir);
+    }
+    if (pipe(wakePipe) < 0) {
+        throw std::runtime_error("Could not create wake pipe");
+    }
+    fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+
+    inotifyFd = inotify_init1(IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        close(wakePipe[0]);
+        close(wakePipe[1]);
+        throw std::runtime_error("Could not initialize inotify");
+    }
+    // Close/move events mark a file as ready; IN_MODIFY puts it back on hold until the next close
+    if (inotify_add_watch(inotifyFd, inputDir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY) < 0) {
+        close(inotifyFd);
+        close(wakePipe[0]);
+        close(wakePipe[1]);
+        throw std::runtime_error("Could not watch directory: " + inputDir);
+    }
+
+    loadJournal();
+#endif
+}
+
+WatchFolder::~WatchFolder() {
+    close(inotifyFd);
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+}
+
+void WatchFolder::setResizerSetup(std::function<void(FFmpegResizer&)> setup) {
+    resizerSetup = setup;
+}
+
+void WatchFolder::setDebounceMilliseconds(int milliseconds) {
+    debounceMilliseconds = std::max(0, milliseconds);
+}
+
+void WatchFolder::stop() {
+    ssize_t ignored = write(wakePipe[1], &STOP_BYTE, 1);
+    (void)ignored;
+}
+
+bool WatchFolder::statFile(const std::string& name, FileKey& key) const {
+    key.name = name;
+    return readFileIdentity(inputDir + "/" + name, key.file);
+}
+
+// Journal lines are "<size> <mtime in ns> <device> <inode> <name>"; a truncated last line
+// from a crash is ignored
+void WatchFolder::loadJournal() {
+    std::ifstream journal(journalPath);
+    FileKey key;
+    while (journal >> key.file.size >> key.file.mtimeNanoseconds >> key.file.device >> key.file.inode &&
+           journal.get() == ' ' && std::getline(journal, key.name)) {
+        seen.insert(key);
+    }
+}
+
+void WatchFolder::appendJournal(const FileKey& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    FILE* journal = fopen(journalPath.c_str(), "a");
+    if (!journal) {
+        std::cerr << "Could not open journal: " << journalPath << std::endl;
+        return;
+    }
+    fprintf(journal, "%lld %lld %llu %llu %s\n", static_cast<long long>(key.file.size),
+            static_cast<long long>(key.file.mtimeNanoseconds), static_cast<unsigned long long>(key.file.device),
+            static_cast<unsigned long long>(key.file.inode), key.name.c_str());
+    fclose(journal);
+}
+
+// Mark a file as taken; false if this version was already processed or is in flight. Only one
+// job per name runs at a time, since every version writes the same outputs: a different version
+// of a busy name is retried once the running job finishes.
+bool WatchFolder::claim(const FileKey& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (seen.count(key)) {
+        return false;
+    }
+    if (!running.insert(key.name).second) {
+        retry.insert(key.name);
+        return false;
+    }
+    seen.insert(key);
+    return true;
+}
+
+void WatchFolder::finish(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    running.erase(name);
+    if (retry.count(name)) {
+        ssize_t ignored = write(wakePipe[1], &RETRY_BYTE, 1);
+        (void)ignored;
+    }
+}
+
+void WatchFolder::processFile(const FileKey& key) {
+    TraceScope trace(TRACE_CATEGORY, "job");
+    std::string inputPath = inputDir + "/" + key.name;
+    try {
+        FFmpegResizer resizer;
+        if (resizerSetup) {
+            resizerSetup(resizer);
+        }
+        // Largest first, so a reduced-size decode left in a frame cache also covers the smaller presets
+        for (int i = PRESET_COUNT - 1; i >= 0; i--) {
+            const PresetSpec& preset = PRESETS[i];
+            // The source extension stays in the name so a.jpg and a.png do not overwrite each other
+            std::string outputPath = outputDir + "/" + key.name + "_" + preset.name + ".jpg";
+            resizer.resizeWithPreset(inputPath, outputPath, preset.size);
+        }
+        appendJournal(key);
+        std::cout << "Processed " << key.name << std::endl;
+    } catch (const std::exception& e) {
+        // Left out of the journal so the next start retries it
+        std::cerr << "Failed to process " << key.name << ": " << e.what() << std::endl;
+        std::lock_guard<std::mutex> lock(mutex);
+        seen.erase(key);
+    }
+    finish(key.name);
+}
+
+void WatchFolder::run() {
+#ifdef __linux__
+    ThreadPool pool(threadCount);
+    auto submit = [&](const std::string& name) {
+        FileKey key;
+        if (!ignoredName(name) && statFile(name, key) && claim(key)) {
+            pool.submit([this, key] { processFile(key); });
+        }
+    };
+
+    // Files with a completion event, waiting for their quiet period to pass
+    std::map<std::string, Clock::time_point> pending;
+    const Clock::duration debounce = std::chrono::milliseconds(debounceMilliseconds);
+
+    // Scanned files may still be mid-upload, so they wait out the quiet period like any other
+    auto scanDirectory = [&]() {
+        if (DIR* dir = opendir(inputDir.c_str())) {
+            Clock::time_point ready = Clock::now() + debounce;
+            while (dirent* entry = readdir(dir)) {
+                if (!ignoredName(entry->d_name)) {
+                    pending[entry->d_name] = ready;
+                }
+            }
+            closedir(dir);
+        }
+    };
+
+    // Catch up on files that arrived while we were not running
+    scanDirectory();
+
+    alignas(inotify_event) char buffer[64 * 1024];
+    for (;;) {
+        int timeout = -1;
+        if (!pending.empty()) {
+            Clock::time_point next = Clock::time_point::max();
+            for (const auto& entry : pending) {
+                next = std::min(next, entry.second);
+            }
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now()).count();
+            timeout = static_cast<int>(std::max<int64_t>(0, wait));
+        }
+
+        pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {wakePipe[0], POLLIN, 0}};
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+            throw std::runtime_error(std::string("poll failed: ") + std::strerror(errno));
+        }
+        if (fds[1].revents & POLLIN) {
+            char bytes[64];
+            bool stopping = false;
+            for (ssize_t count; (count = read(wakePipe[0], bytes, sizeof(bytes))) > 0;) {
+                stopping = stopping || std::find(bytes, bytes + count, STOP_BYTE) != bytes + count;
+            }
+            if (stopping) {
+                break;
+            }
+            // Newer versions of names whose job has just finished
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto it = retry.begin(); it != retry.end();) {
+                if (running.count(*it)) {
+                    ++it;
+                } else {
+                    pending[*it] = Clock::now() + debounce;
+                    it = retry.erase(it);
+                }
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+            Clock::time_point now = Clock::now();
+            for (ssize_t offset = 0; offset < length;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+                if (event->mask & IN_Q_OVERFLOW) {
+                    // The kernel dropped events; anything may have arrived, so look at everything
+                    std::cerr << "inotify queue overflowed, rescanning " << inputDir << std::endl;
+                    scanDirectory();
+                    continue;
+                }
+                if (event->len == 0 || (event->mask & IN_ISDIR)) {
+                    continue;
+                }
+                std::string name = event->name;
+                if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                    pending[name] = now + debounce;
+                } else if (event->mask & IN_MODIFY) {
+                    // Written to again (e.g. reopened for append): wait for the next close
+                    pending.erase(name);
+                }
+            }
+        }
+
+        Clock::time_point now = Clock::now();
+        for (auto it = pending.begin(); it != pending.end();) {
+            if (it->second <= now) {
+                submit(it->first);
+                it = pending.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    // The pool destructor lets queued jobs finish before returning
+#endif
+}
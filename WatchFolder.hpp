@@ -0,0 +1,73 @@
+#ifndef WATCH_FOLDER_HPP
+#define WATCH_FOLDER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include "FFmpegResizer.hpp"
+
+// Watches a directory with inotify (Linux only) and resizes every completed file into
+// all presets on an in-process worker pool. A file counts as complete after a
+// close-after-write or a rename into the directory, followed by a quiet period.
+// Finished files are appended to a journal so a restart skips them.
+class WatchFolder {
+public:
+    // journalPath defaults to <outputDir>/.resize_journal; threads = 0 uses every core
+    WatchFolder(const std::string& inputDir, const std::string& outputDir,
+                const std::string& journalPath = "", unsigned threads = 0);
+    ~WatchFolder();
+
+    WatchFolder(const WatchFolder&) = delete;
+    WatchFolder& operator=(const WatchFolder&) = delete;
+
+    // Applied to each job's resizer before it runs (crop, JPEG backend, quality, ...)
+    void setResizerSetup(std::function<void(FFmpegResizer&)> setup);
+
+    // Time a file must stay untouched after its last event before it is processed
+    void setDebounceMilliseconds(int milliseconds);
+
+    // Process files already in the directory, then block handling events until stop()
+    void run();
+
+    // Safe to call from another thread or a signal handler
+    void stop();
+
+private:
+    struct FileKey {
+        std::string name;
+        FileIdentity file;
+
+        bool operator<(const FileKey& other) const;
+    };
+
+    bool statFile(const std::string& name, FileKey& key) const;
+    void loadJournal();
+    void appendJournal(const FileKey& key);
+    bool claim(const FileKey& key);
+    void finish(const std::string& name);
+    void processFile(const FileKey& key);
+
+    std::string inputDir;
+    std::string outputDir;
+    std::string journalPath;
+    unsigned threadCount;
+    int debounceMilliseconds = 200;
+    std::function<void(FFmpegResizer&)> resizerSetup;
+
+    int inotifyFd = -1;
+    // Self-pipe waking run(): stop() and finish() write to it
+    int wakePipe[2] = {-1, -1};
+
+    // Files journaled or currently being processed, keyed by name and FileIdentity
+    // so a replaced file with the same name is picked up again
+    std::mutex mutex;
+    std::set<FileKey> seen;
+    // Names with a job in flight; a newer version of one waits in retry until that job is done
+    std::set<std::string> running;
+    std::set<std::string> retry;
+};
+
+#endif // WATCH_FOLDER_HPP
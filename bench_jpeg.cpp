@@ -0,0 +1,93 @@
+/**
+ * Benchmark for the JPEG codec backends.
+ * Encodes a synthetic RGB image with every available backend and setting, reporting
+ * throughput and output size, then times full-size and 1/4-scale decodes.
+ * Usage:
+ * $ ./bench_jpeg [iterations] [width] [height]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "JpegCodec.hpp"
+
+template <typename Fn>
+static double timeMs(int iterations, Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        fn();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 20;
+    int width = argc > 2 ? std::atoi(argv[2]) : 1920;
+    int height = argc > 3 ? std::atoi(argv[3]) : 1080;
+
+    // Smooth gradients with some noise, roughly like a photo
+    std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t* pixel = &rgb[(static_cast<size_t>(y) * width + x) * 3];
+            pixel[0] = static_cast<uint8_t>(x * 255 / width + (std::rand() & 7));
+            pixel[1] = static_cast<uint8_t>(y * 255 / height + (std::rand() & 7));
+            pixel[2] = static_cast<uint8_t>((x + y) / 8 + (std::rand() & 7));
+        }
+    }
+    const double megapixels = static_cast<double>(width) * height / 1e6;
+
+    std::cout << width << "x" << height << ", " << iterations << " iterations" << std::endl;
+    std::cout << "backend  quality  optimize  progressive  encode(ms)    MP/s      bytes" << std::endl;
+
+    for (JpegBackend backend : {JpegBackend::LIBAV, JpegBackend::TURBO}) {
+        if (!jpegBackendAvailable(backend)) {
+            continue;
+        }
+        std::unique_ptr<JpegCodec> codec = createJpegCodec(backend);
+        std::vector<uint8_t> jpeg;
+
+        for (int quality : {75, 90}) {
+            for (bool optimize : {false, true}) {
+                for (bool progressive : {false, true}) {
+                    // libav's MJPEG encoder has no progressive mode
+                    if (progressive && backend == JpegBackend::LIBAV) {
+                        continue;
+                    }
+                    JpegOptions options;
+                    options.quality = quality;
+                    options.optimizeCoding = optimize;
+                    options.progressive = progressive;
+
+                    double ms = timeMs(iterations, [&] {
+                        codec->encode(rgb.data(), width * 3, width, height, options, jpeg);
+                    });
+                    std::cout << std::left << std::setw(9) << codec->name() << std::right
+                              << std::setw(7) << quality << std::setw(10) << (optimize ? "yes" : "no")
+                              << std::setw(13) << (progressive ? "yes" : "no")
+                              << std::fixed << std::setprecision(2) << std::setw(12) << ms
+                              << std::setw(8) << megapixels / (ms / 1000.0)
+                              << std::setw(11) << jpeg.size() << std::endl;
+                }
+            }
+        }
+
+        // Decode the last baseline encode at full size and at a quarter of the width
+        JpegOptions options;
+        codec->encode(rgb.data(), width * 3, width, height, options, jpeg);
+        for (int divisor : {1, 4}) {
+            double ms = timeMs(iterations, [&] {
+                AVFrame* decoded = codec->decode(jpeg.data(), jpeg.size(), width / divisor, height / divisor);
+                av_frame_free(&decoded);
+            });
+            std::cout << std::left << std::setw(9) << codec->name() << std::right
+                      << "  decode 1/" << divisor << std::fixed << std::setprecision(2)
+                      << std::setw(33) << ms << std::setw(8) << megapixels / (ms / 1000.0) << std::endl;
+        }
+    }
+    return 0;
+}
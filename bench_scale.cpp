@@ -0,0 +1,119 @@
+/**
+ * Benchmark for the exact-ratio box downsampling fast path.
+ * Compares box-averaging the YUV planes (plus a same-size colorspace conversion)
+ * against a single SWS_BILINEAR sws_scale call, both producing RGB24.
+ * Usage:
+ * $ ./bench_scale [iterations]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+}
+
+#include "FastScale.hpp"
+
+static AVFrame* allocFrame(AVPixelFormat format, int width, int height) {
+    AVFrame* frame = av_frame_alloc();
+    if (!frame) {
+        throw std::runtime_error("Could not allocate frame");
+    }
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        av_frame_free(&frame);
+        throw std::runtime_error("Could not allocate frame buffer");
+    }
+    return frame;
+}
+
+// Fill the planes with a gradient plus noise so neither path sees constant data
+static void fillSynthetic(AVFrame* frame) {
+    for (int plane = 0; plane < 3; plane++) {
+        int width = plane ? AV_CEIL_RSHIFT(frame->width, 1) : frame->width;
+        int height = plane ? AV_CEIL_RSHIFT(frame->height, 1) : frame->height;
+        for (int y = 0; y < height; y++) {
+            uint8_t* row = frame->data[plane] + y * frame->linesize[plane];
+            for (int x = 0; x < width; x++) {
+                row[x] = static_cast<uint8_t>((x + y + plane * 64) ^ (std::rand() & 15));
+            }
+        }
+    }
+}
+
+template <typename Fn>
+static double timeMs(int iterations, Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        fn();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 50;
+    const int dstWidth = 650;
+    const int dstHeight = 488;
+
+    uint8_t* rgbData[4] = {nullptr};
+    int rgbLinesize[4] = {0};
+    if (av_image_alloc(rgbData, rgbLinesize, dstWidth, dstHeight, AV_PIX_FMT_RGB24, 1) < 0) {
+        std::cerr << "Could not allocate destination image" << std::endl;
+        return 1;
+    }
+
+    std::cout << "ratio  source        sws_bilinear(ms)  box(ms)  speedup" << std::endl;
+    for (int factor : {2, 4, 8}) {
+        AVFrame* src = allocFrame(AV_PIX_FMT_YUV420P, dstWidth * factor, dstHeight * factor);
+        AVFrame* box = allocFrame(AV_PIX_FMT_YUV420P, dstWidth, dstHeight);
+        fillSynthetic(src);
+
+        SwsContext* bilinear = sws_getContext(src->width, src->height, AV_PIX_FMT_YUV420P,
+                                              dstWidth, dstHeight, AV_PIX_FMT_RGB24,
+                                              SWS_BILINEAR, nullptr, nullptr, nullptr);
+        SwsContext* convert = sws_getContext(dstWidth, dstHeight, AV_PIX_FMT_YUV420P,
+                                             dstWidth, dstHeight, AV_PIX_FMT_RGB24,
+                                             SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if (!bilinear || !convert) {
+            std::cerr << "Could not initialize scaling context" << std::endl;
+            return 1;
+        }
+
+        double swsMs = timeMs(iterations, [&] {
+            sws_scale(bilinear, src->data, src->linesize, 0, src->height, rgbData, rgbLinesize);
+        });
+
+        double boxMs = timeMs(iterations, [&] {
+            for (int plane = 0; plane < 3; plane++) {
+                fastscale::downsamplePlane(factor,
+                                           src->data[plane], src->linesize[plane],
+                                           box->data[plane], box->linesize[plane],
+                                           plane ? AV_CEIL_RSHIFT(dstWidth, 1) : dstWidth,
+                                           plane ? AV_CEIL_RSHIFT(dstHeight, 1) : dstHeight);
+            }
+            sws_scale(convert, box->data, box->linesize, 0, dstHeight, rgbData, rgbLinesize);
+        });
+
+        std::cout << factor << ":1    " << std::setw(5) << src->width << "x" << std::left << std::setw(8)
+                  << src->height << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(16) << swsMs << std::setw(9) << boxMs
+                  << std::setw(8) << std::setprecision(2) << swsMs / boxMs << "x" << std::endl;
+
+        sws_freeContext(bilinear);
+        sws_freeContext(convert);
+        av_frame_free(&box);
+        av_frame_free(&src);
+    }
+
+    av_freep(&rgbData[0]);
+    return 0;
+}
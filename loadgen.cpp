@@ -0,0 +1,493 @@
+/**
+ * Load generator for the resizer and converter libraries.
+ * Replays a synthetic job mix (JPEG images of several sizes plus short videos) at each
+ * concurrency level from 1 up to --max-concurrency, either closed-loop (every worker runs
+ * jobs back to back) or open-loop at a fixed arrival rate, and reports throughput,
+ * p50/p99/p999 latency and CPU utilization per level as a table, CSV and/or JSON.
+ * Usage:
+ * $ ./loadgen [--max-concurrency N] [--duration SECONDS] [--rate JOBS_PER_SECOND]
+ *             [--video-fraction 0-1] [--seed N] [--csv FILE] [--json FILE]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "FFmpegResizer.hpp"
+#include "JpegCodec.hpp"
+#include "VideoConverter.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    unsigned maxConcurrency = std::max(1u, std::thread::hardware_concurrency());
+    double durationSeconds = 10;
+    double arrivalRate = 0;  // 0 = closed loop
+    double videoFraction = 0.05;
+    unsigned seed = 1;
+    std::string csvPath;
+    std::string jsonPath;
+};
+
+// Source sizes and how often they appear in the mix, roughly a phone/camera upload profile
+struct ImageClass {
+    int width;
+    int height;
+    double weight;
+};
+
+const ImageClass IMAGE_MIX[] = {
+    {640, 480, 0.30},
+    {1280, 720, 0.30},
+    {1920, 1080, 0.25},
+    {4032, 3024, 0.15},
+};
+
+struct LevelResult {
+    unsigned concurrency;
+    int64_t completed;
+    int64_t failed;
+    double wallSeconds;
+    double throughput;
+    double p50Ms;
+    double p99Ms;
+    double p999Ms;
+    double cpuSeconds;
+    double cpuUtilization;  // Fraction of all hardware threads kept busy
+};
+
+static double cpuSecondsUsed() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Inputs and job outputs all live in one flat scratch directory
+static void removeDirectory(const std::string& directory) {
+    if (DIR* dir = opendir(directory.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..") {
+                std::remove((directory + "/" + name).c_str());
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(directory.c_str());
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const std::vector<double>& sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+    return sorted[std::min(sorted.size() - 1, rank ? rank - 1 : 0)];
+}
+
+// Gradient plus noise, roughly like a photo, so encode and decode costs are realistic
+static void writeSyntheticImage(const std::string& path, int width, int height, std::mt19937& random) {
+    std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t* pixel = &rgb[(static_cast<size_t>(y) * width + x) * 3];
+            pixel[0] = static_cast<uint8_t>(x * 255 / width + (random() & 7));
+            pixel[1] = static_cast<uint8_t>(y * 255 / height + (random() & 7));
+            pixel[2] = static_cast<uint8_t>((x + y) / 8 + (random() & 7));
+        }
+    }
+
+    std::vector<uint8_t> jpeg;
+    createJpegCodec(JpegBackend::LIBAV)->encode(rgb.data(), width * 3, width, height, JpegOptions(), jpeg);
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("Could not write " + path);
+    }
+    fwrite(jpeg.data(), 1, jpeg.size(), file);
+    fclose(file);
+}
+
+// A few seconds of moving gradient encoded as MPEG-4 Part 2, which every libavcodec build has
+static void writeSyntheticVideo(const std::string& path, int width, int height, int frames) {
+    AVFormatContext* formatContext = nullptr;
+    AVCodecContext* encoder = nullptr;
+    AVFrame* frame = nullptr;
+    AVPacket* packet = nullptr;
+
+    auto cleanup = [&]() {
+        av_packet_free(&packet);
+        av_frame_free(&frame);
+        avcodec_free_context(&encoder);
+        if (formatContext) {
+            if (formatContext->pb) {
+                avio_closep(&formatContext->pb);
+            }
+            avformat_free_context(formatContext);
+            formatContext = nullptr;
+        }
+    };
+
+    try {
+        avformat_alloc_output_context2(&formatContext, nullptr, "mp4", path.c_str());
+        const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+        if (!formatContext || !codec) {
+            throw std::runtime_error("Could not set up synthetic video output");
+        }
+
+        encoder = avcodec_alloc_context3(codec);
+        if (!encoder) {
+            throw std::runtime_error("Could not allocate synthetic video encoder");
+        }
+        encoder->width = width;
+        encoder->height = height;
+        encoder->pix_fmt = AV_PIX_FMT_YUV420P;
+        encoder->time_base = AVRational{1, 25};
+        encoder->framerate = AVRational{25, 1};
+        encoder->gop_size = 25;
+        encoder->bit_rate = 2000000;
+        if (formatContext->oformat->flags & AVFMT_GLOBALHEADER) {
+            encoder->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        }
+        AVStream* stream = avformat_new_stream(formatContext, nullptr);
+        if (avcodec_open2(encoder, codec, nullptr) < 0 || !stream ||
+            avcodec_parameters_from_context(stream->codecpar, encoder) < 0) {
+            throw std::runtime_error("Could not open synthetic video encoder");
+        }
+        stream->time_base = encoder->time_base;
+        if (avio_open(&formatContext->pb, path.c_str(), AVIO_FLAG_WRITE) < 0 ||
+            avformat_write_header(formatContext, nullptr) < 0) {
+            throw std::runtime_error("Could not write " + path);
+        }
+
+        frame = av_frame_alloc();
+        packet = av_packet_alloc();
+        if (!frame || !packet) {
+            throw std::runtime_error("Failed to allocate frame or packet");
+        }
+        frame->format = encoder->pix_fmt;
+        frame->width = width;
+        frame->height = height;
+        if (av_frame_get_buffer(frame, 0) < 0) {
+            throw std::runtime_error("Failed to allocate frame buffer");
+        }
+
+        auto encode = [&](const AVFrame* input) {
+            if (avcodec_send_frame(encoder, input) < 0) {
+                throw std::runtime_error("Error sending frame to synthetic video encoder");
+            }
+            while (avcodec_receive_packet(encoder, packet) >= 0) {
+                av_packet_rescale_ts(packet, encoder->time_base, stream->time_base);
+                packet->stream_index = stream->index;
+                if (av_interleaved_write_frame(formatContext, packet) < 0) {
+                    throw std::runtime_error("Could not write " + path);
+                }
+            }
+        };
+        for (int i = 0; i < frames; i++) {
+            // The encoder may still hold a reference to the previous frame's buffers
+            if (av_frame_make_writable(frame) < 0) {
+                throw std::runtime_error("Failed to make frame writable");
+            }
+            for (int plane = 0; plane < 3; plane++) {
+                int planeWidth = plane ? width / 2 : width;
+                int planeHeight = plane ? height / 2 : height;
+                for (int y = 0; y < planeHeight; y++) {
+                    uint8_t* row = frame->data[plane] + y * frame->linesize[plane];
+                    for (int x = 0; x < planeWidth; x++) {
+                        row[x] = static_cast<uint8_t>(x + y + i * 3 + plane * 64);
+                    }
+                }
+            }
+            frame->pts = i;
+            encode(frame);
+        }
+        encode(nullptr);
+        if (av_write_trailer(formatContext) < 0) {
+            throw std::runtime_error("Could not write " + path);
+        }
+    } catch (...) {
+        cleanup();
+        throw;
+    }
+    cleanup();
+}
+
+// Generated inputs and the weighted choice between them
+class JobMix {
+public:
+    JobMix(const std::string& directory, double videoFraction, unsigned seed)
+        : directory(directory), videoFraction(videoFraction) {
+        std::mt19937 random(seed);
+        for (const ImageClass& image : IMAGE_MIX) {
+            std::string path = directory + "/image_" + std::to_string(image.width) + "x" +
+                               std::to_string(image.height) + ".jpg";
+            writeSyntheticImage(path, image.width, image.height, random);
+            images.push_back(path);
+            imageWeights.push_back(image.weight);
+        }
+        if (videoFraction > 0) {
+            video = directory + "/video_640x360.mp4";
+            writeSyntheticVideo(video, 640, 360, 75);
+        }
+    }
+
+    // Run one job on the calling thread; `worker` keeps output files apart
+    void run(std::mt19937& random, unsigned worker) {
+        std::string prefix = directory + "/out_" + std::to_string(worker);
+        if (!video.empty() && std::uniform_real_distribution<double>(0, 1)(random) < videoFraction) {
+            // Same work as convert_video: remux to MP4, then a thumbnail in every preset
+            VideoConverter converter;
+            converter.convertToMP4(video, prefix + ".mp4");
+            converter.extractThumbnail(video, prefix + "_thumbnail.jpg");
+            return;
+        }
+        // Same work as resize_image: one preset of one image
+        std::discrete_distribution<size_t> pickImage(imageWeights.begin(), imageWeights.end());
+        const PresetSpec& preset = PRESETS[std::uniform_int_distribution<int>(0, PRESET_COUNT - 1)(random)];
+        FFmpegResizer resizer;
+        resizer.resizeWithPreset(images[pickImage(random)], prefix + "_" + preset.name + ".jpg", preset.size);
+    }
+
+private:
+    std::string directory;
+    double videoFraction;
+    std::vector<std::string> images;
+    std::vector<double> imageWeights;
+    std::string video;
+};
+
+// Closed loop: `concurrency` workers each run jobs back to back until the deadline.
+// Open loop: jobs arrive as a Poisson process and queue for the workers; latency is
+// measured from the scheduled arrival, so a backlog shows up instead of being hidden.
+static LevelResult runLevel(JobMix& mix, unsigned concurrency, const Options& options) {
+    std::mutex mutex;
+    std::condition_variable arrived;
+    std::deque<Clock::time_point> queue;
+    bool closed = false;
+    std::vector<double> latencies;
+    std::atomic<int64_t> failed(0);
+
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point deadline = start + std::chrono::duration_cast<Clock::duration>(
+                                                   std::chrono::duration<double>(options.durationSeconds));
+    const double cpuStart = cpuSecondsUsed();
+
+    auto runJob = [&](std::mt19937& random, unsigned worker, Clock::time_point issued) {
+        try {
+            mix.run(random, worker);
+        } catch (const std::exception& e) {
+            if (failed++ == 0) {
+                std::cerr << "Job failed: " << e.what() << std::endl;
+            }
+            return;
+        }
+        std::chrono::duration<double, std::milli> latency = Clock::now() - issued;
+        std::lock_guard<std::mutex> lock(mutex);
+        latencies.push_back(latency.count());
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned worker = 0; worker < concurrency; worker++) {
+        workers.emplace_back([&, worker] {
+            std::mt19937 random(options.seed * 7919 + worker);
+            if (options.arrivalRate <= 0) {
+                while (Clock::now() < deadline) {
+                    runJob(random, worker, Clock::now());
+                }
+                return;
+            }
+            for (;;) {
+                Clock::time_point issued;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    arrived.wait(lock, [&] { return closed || !queue.empty(); });
+                    if (queue.empty()) {
+                        return;
+                    }
+                    issued = queue.front();
+                    queue.pop_front();
+                }
+                runJob(random, worker, issued);
+            }
+        });
+    }
+
+    if (options.arrivalRate > 0) {
+        std::mt19937 random(options.seed);
+        std::exponential_distribution<double> gap(options.arrivalRate);
+        Clock::time_point next = start;
+        while (next < deadline) {
+            std::this_thread::sleep_until(next);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(next);
+            }
+            arrived.notify_one();
+            next += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(gap(random)));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        arrived.notify_all();
+    }
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    std::chrono::duration<double> wall = Clock::now() - start;
+    std::sort(latencies.begin(), latencies.end());
+
+    LevelResult result;
+    result.concurrency = concurrency;
+    result.completed = static_cast<int64_t>(latencies.size());
+    result.failed = failed;
+    result.wallSeconds = wall.count();
+    result.throughput = result.completed / result.wallSeconds;
+    result.p50Ms = percentile(latencies, 0.50);
+    result.p99Ms = percentile(latencies, 0.99);
+    result.p999Ms = percentile(latencies, 0.999);
+    result.cpuSeconds = cpuSecondsUsed() - cpuStart;
+    result.cpuUtilization = result.cpuSeconds /
+                            (result.wallSeconds * std::max(1u, std::thread::hardware_concurrency()));
+    return result;
+}
+
+static void writeCsv(const std::string& path, const std::vector<LevelResult>& results) {
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) {
+        throw std::runtime_error("Could not write " + path);
+    }
+    fputs("concurrency,completed,failed,wall_s,throughput_jobs_s,p50_ms,p99_ms,p999_ms,cpu_s,cpu_utilization\n", out);
+    for (const LevelResult& r : results) {
+        fprintf(out, "%u,%lld,%lld,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.4f\n",
+                r.concurrency, static_cast<long long>(r.completed), static_cast<long long>(r.failed),
+                r.wallSeconds, r.throughput, r.p50Ms, r.p99Ms, r.p999Ms, r.cpuSeconds, r.cpuUtilization);
+    }
+    fclose(out);
+}
+
+static void writeJson(const std::string& path, const Options& options, const std::vector<LevelResult>& results) {
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) {
+        throw std::runtime_error("Could not write " + path);
+    }
+    fprintf(out, "{\"mode\":\"%s\",\"arrival_rate\":%.3f,\"duration_s\":%.3f,\"video_fraction\":%.3f,"
+                 "\"hardware_threads\":%u,\"levels\":[",
+            options.arrivalRate > 0 ? "open" : "closed", options.arrivalRate, options.durationSeconds,
+            options.videoFraction, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < results.size(); i++) {
+        const LevelResult& r = results[i];
+        fprintf(out, "%s\n{\"concurrency\":%u,\"completed\":%lld,\"failed\":%lld,\"wall_s\":%.3f,"
+                     "\"throughput_jobs_s\":%.3f,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f,"
+                     "\"cpu_s\":%.3f,\"cpu_utilization\":%.4f}",
+                i ? "," : "", r.concurrency, static_cast<long long>(r.completed), static_cast<long long>(r.failed),
+                r.wallSeconds, r.throughput, r.p50Ms, r.p99Ms, r.p999Ms, r.cpuSeconds, r.cpuUtilization);
+    }
+    fputs("\n]}\n", out);
+    fclose(out);
+}
+
+static bool parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (option == "--max-concurrency") {
+            options.maxConcurrency = std::max(1, std::atoi(value));
+        } else if (option == "--duration") {
+            options.durationSeconds = std::atof(value);
+        } else if (option == "--rate") {
+            options.arrivalRate = std::atof(value);
+        } else if (option == "--video-fraction") {
+            options.videoFraction = std::min(1.0, std::max(0.0, std::atof(value)));
+        } else if (option == "--seed") {
+            options.seed = static_cast<unsigned>(std::atoi(value));
+        } else if (option == "--csv") {
+            options.csvPath = value;
+        } else if (option == "--json") {
+            options.jsonPath = value;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [--max-concurrency N] [--duration SECONDS] [--rate JOBS_PER_SECOND]"
+                  << " [--video-fraction 0-1] [--seed N] [--csv FILE] [--json FILE]" << std::endl;
+        return 1;
+    }
+
+    char directory[] = "/tmp/loadgen.XXXXXX";
+    if (!mkdtemp(directory)) {
+        std::cerr << "Could not create a scratch directory" << std::endl;
+        return 1;
+    }
+
+    std::vector<LevelResult> results;
+    try {
+        JobMix mix(directory, options.videoFraction, options.seed);
+
+        // Powers of two up to the maximum, plus the maximum itself
+        std::vector<unsigned> levels;
+        for (unsigned level = 1; level < options.maxConcurrency; level *= 2) {
+            levels.push_back(level);
+        }
+        levels.push_back(options.maxConcurrency);
+
+        std::cout << (options.arrivalRate > 0 ? "open loop, " : "closed loop, ")
+                  << options.durationSeconds << " s per level" << std::endl;
+        std::cout << "threads    jobs  failed    jobs/s    p50(ms)    p99(ms)   p999(ms)   cpu%" << std::endl;
+        for (unsigned level : levels) {
+            LevelResult r = runLevel(mix, level, options);
+            results.push_back(r);
+            std::cout << std::setw(7) << r.concurrency << std::setw(8) << r.completed << std::setw(8) << r.failed
+                      << std::fixed << std::setprecision(2) << std::setw(10) << r.throughput
+                      << std::setw(11) << r.p50Ms << std::setw(11) << r.p99Ms << std::setw(11) << r.p999Ms
+                      << std::setprecision(1) << std::setw(7) << r.cpuUtilization * 100 << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        removeDirectory(directory);
+        return 1;
+    }
+    removeDirectory(directory);
+
+    try {
+        if (!options.csvPath.empty()) {
+            writeCsv(options.csvPath, results);
+        }
+        if (!options.jsonPath.empty()) {
+            writeJson(options.jsonPath, options, results);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -7,311 +7,184 @@
  * A C++ library that exposes functions to resize any image to given width preserving the aspect ratio.
  * */ 
 
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
-#include <stdexcept>
 #include <memory>
-#include <cmath>
-
-extern "C" {
-#include <libavcodec/avcodec.h>
-#include <libavformat/avformat.h>
-#include <libswscale/swscale.h>
-#include <libavutil/imgutils.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+
+#include "BatchPipeline.hpp"
+#include "FFmpegResizer.hpp"
+#include "WatchFolder.hpp"
+
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " <input_file> <output_file> [--all-frames] [--crop W:H]"
+              << " [--jpeg-backend libav|turbo] [--quality 1-100] [--exif-thumbnail]"
+              << " [--memory-limit MiB]" << std::endl;
+    std::cerr << "       " << program << " <input_dir> <output_dir> --watch [--cache MiB] [options]" << std::endl;
+    std::cerr << "       " << program << " <input_dir> <output_dir> --batch [--stage-threads D:S:E]"
+              << " [--jpeg-backend libav|turbo] [--quality 1-100]" << std::endl;
 }
 
-// Preset sizes
-const int SMALL_WIDTH = 250;
-const int MEDIUM_WIDTH = 350;
-const int LARGE_WIDTH = 650;
-
-enum class ImageSize {
-    SMALL,
-    MEDIUM,
-    LARGE,
-    CUSTOM
-};
+// One job per file in inputDir (skipping dotfiles), producing every preset
+static std::vector<BatchJob> batchJobs(const std::string& inputDir, const std::string& outputDir) {
+    DIR* dir = opendir(inputDir.c_str());
+    if (!dir) {
+        throw std::runtime_error("Could not open directory: " + inputDir);
+    }
+    std::vector<BatchJob> jobs;
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.empty() || name[0] == '.') {
+            continue;
+        }
+        BatchJob job;
+        job.inputPath = inputDir + "/" + name;
+        for (const PresetSpec& preset : PRESETS) {
+            // The source extension stays in the name so a.jpg and a.png do not overwrite each other
+            job.outputs.push_back({outputDir + "/" + name + "_" + preset.name + ".jpg", preset.size});
+        }
+        jobs.push_back(job);
+    }
+    closedir(dir);
+    return jobs;
+}
 
-class FFmpegResizer {
-private:
-    AVFormatContext* inputFormatContext = nullptr;
-    AVCodecContext* codecContext = nullptr;
-    SwsContext* swsContext = nullptr;
-    AVFrame* frame = nullptr;
-    AVPacket* packet = nullptr;
-    uint8_t* dstData[4] = {nullptr};
-    int dstLinesize[4] = {0};
-    int videoStreamIndex = -1;
-    int originalWidth = 0;
-    int originalHeight = 0;
+static WatchFolder* activeWatch = nullptr;
 
-public:
-    ~FFmpegResizer() {
-        cleanup();
+static void stopWatching(int) {
+    if (activeWatch) {
+        activeWatch->stop();
     }
+}
 
-    // Get original dimensions before resize
-    bool getOriginalDimensions(const std::string& inputPath, int& width, int& height) {
-        if (avformat_open_input(&inputFormatContext, inputPath.c_str(), nullptr, nullptr) < 0) {
-            return false;
-        }
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        printUsage(argv[0]);
+        return 1;
+    }
 
-        if (avformat_find_stream_info(inputFormatContext, nullptr) < 0) {
-            avformat_close_input(&inputFormatContext);
-            return false;
-        }
+    try {
+        std::string inputPath = argv[1];
+        std::string outputPath = argv[2];
 
-        for (unsigned int i = 0; i < inputFormatContext->nb_streams; i++) {
-            if (inputFormatContext->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-                width = inputFormatContext->streams[i]->codecpar->width;
-                height = inputFormatContext->streams[i]->codecpar->height;
-                avformat_close_input(&inputFormatContext);
-                return true;
+        bool watch = false;
+        bool batch = false;
+        StageThreads stageThreads;
+        bool allFrames = false;
+        bool crop = false;
+        bool exifThumbnail = false;
+        int64_t memoryLimit = 0;
+        std::shared_ptr<FrameCache> frameCache;
+        int aspectWidth = 0, aspectHeight = 0;
+        JpegBackend backend = JpegBackend::LIBAV;
+        JpegOptions jpegOptions;
+
+        for (int i = 3; i < argc; i++) {
+            std::string option = argv[i];
+            if (option == "--watch") {
+                // Treat the arguments as directories and resize every new file into all presets
+                watch = true;
+            } else if (option == "--batch") {
+                // Resize every file in the directory into all presets with the staged pipeline
+                batch = true;
+            } else if (option == "--stage-threads" && i + 1 < argc &&
+                       std::sscanf(argv[i + 1], "%u:%u:%u", &stageThreads.decode,
+                                   &stageThreads.scale, &stageThreads.encode) == 3) {
+                // Decode, scale and encode workers, e.g. 4:1:2
+                i++;
+            } else if (option == "--all-frames") {
+                // Animated inputs (GIF, WebP, APNG) keep every frame; the output extension picks the container
+                allFrames = true;
+            } else if (option == "--crop" && i + 1 < argc &&
+                       std::sscanf(argv[i + 1], "%d:%d", &aspectWidth, &aspectHeight) == 2) {
+                // Centre crop to the given aspect ratio, e.g. 1:1 or 16:9
+                crop = true;
+                i++;
+            } else if (option == "--jpeg-backend" && i + 1 < argc && jpegBackendFromName(argv[i + 1], backend)) {
+                i++;
+            } else if (option == "--quality" && i + 1 < argc) {
+                jpegOptions.quality = std::atoi(argv[++i]);
+            } else if (option == "--exif-thumbnail") {
+                // Scale the camera's embedded thumbnail when it is at least as large as the output
+                exifThumbnail = true;
+            } else if (option == "--memory-limit" && i + 1 < argc) {
+                // Fail the job instead of growing past this many MiB of frame and image buffers
+                memoryLimit = static_cast<int64_t>(std::atoi(argv[++i])) * 1024 * 1024;
+            } else if (option == "--cache" && i + 1 < argc) {
+                // Watch mode: keep up to this many MiB of decoded sources so every preset of a file decodes it once
+                int64_t budget = static_cast<int64_t>(std::atoi(argv[++i])) * 1024 * 1024;
+                frameCache = budget > 0 ? std::make_shared<FrameCache>(budget) : nullptr;
+            } else {
+                printUsage(argv[0]);
+                return 1;
             }
         }
 
-        avformat_close_input(&inputFormatContext);
-        return false;
-    }
-
-    // Calculate height maintaining aspect ratio
-    int calculateHeight(int targetWidth, int originalWidth, int originalHeight) {
-        return static_cast<int>(round(static_cast<double>(originalHeight) * targetWidth / originalWidth));
-    }
-
-    void resizeWithPreset(const std::string& inputPath, const std::string& outputPath, ImageSize size) {
-        int originalWidth, originalHeight;
-        if (!getOriginalDimensions(inputPath, originalWidth, originalHeight)) {
-            throw std::runtime_error("Could not get original image dimensions");
+        // Only watch mode resizes one source more than once through FFmpegResizer
+        // (batch mode decodes each source once by design)
+        if (frameCache && !watch) {
+            printUsage(argv[0]);
+            return 1;
         }
-
-        int targetWidth;
-        switch (size) {
-            case ImageSize::SMALL:
-                targetWidth = SMALL_WIDTH;
-                break;
-            case ImageSize::MEDIUM:
-                targetWidth = MEDIUM_WIDTH;
-                break;
-            case ImageSize::LARGE:
-                targetWidth = LARGE_WIDTH;
-                break;
-            default:
-                throw std::runtime_error("Invalid preset size");
+        // The batch pipeline only decodes, scales and encodes; it has no FFmpegResizer to apply these to
+        if (batch && (allFrames || crop || exifThumbnail || memoryLimit > 0)) {
+            printUsage(argv[0]);
+            return 1;
         }
 
-        int targetHeight = calculateHeight(targetWidth, originalWidth, originalHeight);
-        resize(inputPath, outputPath, targetWidth, targetHeight);
-    }
-
-    void resize(const std::string& inputPath, const std::string& outputPath, 
-                int dstWidth, int dstHeight) {
-        try {
-            // Open input file
-            if (avformat_open_input(&inputFormatContext, inputPath.c_str(), nullptr, nullptr) < 0) {
-                throw std::runtime_error("Could not open input file");
-            }
-
-            if (avformat_find_stream_info(inputFormatContext, nullptr) < 0) {
-                throw std::runtime_error("Could not find stream info");
-            }
-
-            // Find video stream
-            for (unsigned int i = 0; i < inputFormatContext->nb_streams; i++) {
-                if (inputFormatContext->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-                    videoStreamIndex = i;
-                    originalWidth = inputFormatContext->streams[i]->codecpar->width;
-                    originalHeight = inputFormatContext->streams[i]->codecpar->height;
-                    break;
-                }
-            }
-
-            if (videoStreamIndex == -1) {
-                throw std::runtime_error("Could not find video stream");
-            }
-
-            // Get codec parameters
-            AVCodecParameters* codecParams = inputFormatContext->streams[videoStreamIndex]->codecpar;
-            const AVCodec* codec = avcodec_find_decoder(codecParams->codec_id);
-            if (!codec) {
-                throw std::runtime_error("Codec not found");
-            }
-
-            // Create codec context
-            codecContext = avcodec_alloc_context3(codec);
-            if (!codecContext) {
-                throw std::runtime_error("Could not allocate codec context");
-            }
-
-            if (avcodec_parameters_to_context(codecContext, codecParams) < 0) {
-                throw std::runtime_error("Could not copy codec params to codec context");
-            }
-
-            if (avcodec_open2(codecContext, codec, nullptr) < 0) {
-                throw std::runtime_error("Could not open codec");
-            }
-
-            // Allocate frame and packet
-            frame = av_frame_alloc();
-            packet = av_packet_alloc();
-            if (!frame || !packet) {
-                throw std::runtime_error("Could not allocate frame or packet");
+        auto configure = [=](FFmpegResizer& resizer) {
+            if (allFrames) {
+                resizer.setFrameMode(FrameMode::ALL);
             }
-
-            // Create scaling context
-            swsContext = sws_getContext(
-                codecContext->width, codecContext->height, codecContext->pix_fmt,
-                dstWidth, dstHeight, AV_PIX_FMT_RGB24,
-                SWS_BILINEAR, nullptr, nullptr, nullptr
-            );
-
-            if (!swsContext) {
-                throw std::runtime_error("Could not initialize scaling context");
-            }
-
-            // Allocate destination image buffer
-            int ret = av_image_alloc(dstData, dstLinesize,
-                                   dstWidth, dstHeight,
-                                   AV_PIX_FMT_RGB24, 1);
-            if (ret < 0) {
-                throw std::runtime_error("Could not allocate destination image");
+            if (crop) {
+                resizer.setCenterCrop(aspectWidth, aspectHeight);
             }
-
-            // Read frames
-            while (av_read_frame(inputFormatContext, packet) >= 0) {
-                if (packet->stream_index == videoStreamIndex) {
-                    if (processPacket(dstWidth, dstHeight)) {
-                        // Write output file (first frame only)
-                        writeJPEG(outputPath, dstWidth, dstHeight);
-                        break;
-                    }
+            resizer.setJpegBackend(backend);
+            resizer.setJpegOptions(jpegOptions);
+            ThumbnailPolicy thumbnailPolicy;
+            thumbnailPolicy.useExifThumbnail = exifThumbnail;
+            resizer.setThumbnailPolicy(thumbnailPolicy);
+            resizer.setMemoryLimit(memoryLimit);
+            resizer.setFrameCache(frameCache);
+        };
+
+        if (watch) {
+            WatchFolder watcher(inputPath, outputPath);
+            watcher.setResizerSetup(configure);
+            activeWatch = &watcher;
+            std::signal(SIGINT, stopWatching);
+            std::signal(SIGTERM, stopWatching);
+            std::cout << "Watching " << inputPath << " (Ctrl+C to stop)" << std::endl;
+            watcher.run();
+            activeWatch = nullptr;
+            return 0;
+        }
+
+        if (batch) {
+            BatchPipeline pipeline(stageThreads);
+            pipeline.setJpegBackend(backend);
+            pipeline.setJpegOptions(jpegOptions);
+            std::vector<BatchJob> jobs = batchJobs(inputPath, outputPath);
+            std::vector<std::string> errors = pipeline.run(jobs);
+            int failed = 0;
+            for (size_t i = 0; i < jobs.size(); i++) {
+                if (!errors[i].empty()) {
+                    std::cerr << jobs[i].inputPath << ": " << errors[i] << std::endl;
+                    failed++;
                 }
-                av_packet_unref(packet);
             }
-        } catch (const std::exception& e) {
-            cleanup();
-            throw;
-        }
-        cleanup();
-    }
-
-private:
-    // [Previous private methods remain the same]
-    bool processPacket(int dstWidth, int dstHeight) {
-        int ret = avcodec_send_packet(codecContext, packet);
-        if (ret < 0) {
-            return false;
-        }
-
-        ret = avcodec_receive_frame(codecContext, frame);
-        if (ret < 0) {
-            return false;
-        }
-
-        // Scale the image
-        sws_scale(swsContext,
-                 frame->data, frame->linesize, 0, codecContext->height,
-                 dstData, dstLinesize);
-        return true;
-    }
-
-    void writeJPEG(const std::string& outputPath, int dstWidth, int dstHeight) {
-        const AVCodec* jpegCodec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
-        if (!jpegCodec) {
-            throw std::runtime_error("Could not find JPEG encoder");
+            std::cout << "Processed " << jobs.size() - failed << " of " << jobs.size() << " files" << std::endl;
+            return failed ? 1 : 0;
         }
 
-        AVCodecContext* jpegContext = avcodec_alloc_context3(jpegCodec);
-        if (!jpegContext) {
-            throw std::runtime_error("Could not allocate JPEG context");
-        }
-
-        jpegContext->width = dstWidth;
-        jpegContext->height = dstHeight;
-        jpegContext->time_base = AVRational{1, 25};
-        jpegContext->pix_fmt = AV_PIX_FMT_YUVJ420P;
-        jpegContext->codec_type = AVMEDIA_TYPE_VIDEO;
-
-        if (avcodec_open2(jpegContext, jpegCodec, nullptr) < 0) {
-            avcodec_free_context(&jpegContext);
-            throw std::runtime_error("Could not open JPEG encoder");
-        }
-
-        AVFrame* jpegFrame = av_frame_alloc();
-        jpegFrame->width = dstWidth;
-        jpegFrame->height = dstHeight;
-        jpegFrame->format = AV_PIX_FMT_YUVJ420P;
-        
-        if (av_frame_get_buffer(jpegFrame, 0) < 0) {
-            av_frame_free(&jpegFrame);
-            avcodec_free_context(&jpegContext);
-            throw std::runtime_error("Could not allocate JPEG frame buffer");
-        }
-
-        SwsContext* rgbToYuvContext = sws_getContext(
-            dstWidth, dstHeight, AV_PIX_FMT_RGB24,
-            dstWidth, dstHeight, AV_PIX_FMT_YUVJ420P,
-            SWS_BILINEAR, nullptr, nullptr, nullptr
-        );
-
-        sws_scale(rgbToYuvContext,
-                 dstData, dstLinesize, 0, dstHeight,
-                 jpegFrame->data, jpegFrame->linesize);
-
-        FILE* outFile = fopen(outputPath.c_str(), "wb");
-        if (!outFile) {
-            sws_freeContext(rgbToYuvContext);
-            av_frame_free(&jpegFrame);
-            avcodec_free_context(&jpegContext);
-            throw std::runtime_error("Could not open output file");
-        }
-
-        AVPacket* jpegPacket = av_packet_alloc();
-        
-        avcodec_send_frame(jpegContext, jpegFrame);
-        avcodec_receive_packet(jpegContext, jpegPacket);
-        
-        fwrite(jpegPacket->data, 1, jpegPacket->size, outFile);
-        
-        fclose(outFile);
-        av_packet_free(&jpegPacket);
-        sws_freeContext(rgbToYuvContext);
-        av_frame_free(&jpegFrame);
-        avcodec_free_context(&jpegContext);
-    }
-
-    void cleanup() {
-        if (dstData[0]) {
-            av_freep(&dstData[0]);
-        }
-        if (swsContext) {
-            sws_freeContext(swsContext);
-            swsContext = nullptr;
-        }
-        if (frame) {
-            av_frame_free(&frame);
-        }
-        if (packet) {
-            av_packet_free(&packet);
-        }
-        if (codecContext) {
-            avcodec_free_context(&codecContext);
-        }
-        if (inputFormatContext) {
-            avformat_close_input(&inputFormatContext);
-        }
-    }
-};
-
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <input_file> <output_file>" << std::endl;
-        return 1;
-    }
-
-    try {
         FFmpegResizer resizer;
-        std::string inputPath = argv[1];
-        std::string outputPath = argv[2];
+        configure(resizer);
 
         // Get original dimensions
         int originalWidth, originalHeight;
@@ -328,13 +201,7 @@ int main(int argc, char* argv[]) {
         ImageSize selectedSize;
 
         // Convert input to enum
-        if (sizeInput == "small") {
-            selectedSize = ImageSize::SMALL;
-        } else if (sizeInput == "medium") {
-            selectedSize = ImageSize::MEDIUM;
-        } else if (sizeInput == "large") {
-            selectedSize = ImageSize::LARGE;
-        } else {
+        if (!presetFromName(sizeInput, selectedSize)) {
             std::cerr << "Invalid size. Please enter small, medium, or large." << std::endl;
             return 1;
         }
@@ -345,6 +212,10 @@ int main(int argc, char* argv[]) {
         resizer.resizeWithPreset(inputPath, basename + "_" + sizeInput + extension, selectedSize);
         std::cout << "Created " << sizeInput << " version" << std::endl;
 
+        const JobStats& stats = resizer.lastJobStats();
+        std::cout << "Took " << stats.wallMilliseconds << " ms, peak memory " << stats.memory.peakBytes / 1024
+                  << " KiB over " << stats.memory.allocations << " buffers" << std::endl;
+
         std::cout << "Resized version created successfully" << std::endl;
         return 0;
     } catch (const std::exception& e) {